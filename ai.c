@@ -0,0 +1,774 @@
+/**
+ * ai.c
+ *
+ * Defines functions for an automated player which searches for the best move
+ * using expectimax or random rollouts, in parallel over a pool of threads.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include "ai.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Weights used to evaluate a single row of tiles. Rows score well if they are
+// monotonic, have empty tiles and have tiles which can be merged, and badly
+// if they hold many large tiles.
+#define LOST_PENALTY 200000.0
+#define MONOTONICITY_POWER 4.0
+#define MONOTONICITY_WEIGHT 47.0
+#define SUM_POWER 3.5
+#define SUM_WEIGHT 11.0
+#define MERGES_WEIGHT 700.0
+#define EMPTY_WEIGHT 270.0
+
+// Stop searching below chance nodes less likely than this, since they have
+// little effect on the result.
+#define PROBABILITY_CUTOFF 0.0001
+
+// The most tasks a search can split into: one for each of a '2' or '4' tile
+// being placed on each tile after each of our moves.
+#define MAX_TASKS (4 * DIM * DIM * 2)
+
+// The rollouts after each of our moves are split into at most this many
+// tasks, and each task plays this many games at once.
+#define ROLLOUT_TASKS (MAX_TASKS / 4)
+#define ROLLOUT_BATCH 64
+
+// The flag set in every entry stored in the transposition table, and the
+// bits left for the depth searched.
+#define ENTRY_VALID ((uint64_t) 1 << 31)
+#define ENTRY_DEPTH_MASK 0x7FFF
+
+// An entry in the transposition table. To let threads share the table without
+// locks, the board is stored xor-ed with the data. If two threads write the
+// same entry at once and the halves of the entry are mixed up, the board
+// will not match when read back and the entry is simply ignored.
+struct ai_entry
+{
+    // The board searched, xor-ed with data.
+    _Atomic uint64_t check;
+
+    // The expected value of the board as a float in the top 32 bits, a flag
+    // set in every entry stored in the next bit, the number of moves searched
+    // below the board in the next 15 bits and the generation of the search
+    // which made this entry in the bottom 16 bits. An empty entry is all zero,
+    // so its flag is clear.
+    _Atomic uint64_t data;
+};
+
+// A part of a search. For expectimax, the value of the board after one of
+// our moves and one new tile, weighted by the probability of the new tile.
+// For rollouts, the total score of a number of random games played from the
+// board after one of our moves.
+struct ai_task
+{
+    board_t board;
+    int dir;
+    double weight;
+    int playouts;
+    double value;
+};
+
+// The state of a single thread taking part in a search.
+struct ai_worker
+{
+    // The pool the thread belongs to, and the thread itself. Workers are kept
+    // on separate cache lines since each updates its own node count often.
+    _Alignas(64) struct ai_pool *pool;
+    pthread_t thread;
+
+    // The range of tasks yet to be done by this thread, with the first task
+    // in the top 32 bits and one past the last task in the bottom 32 bits.
+    // The thread takes tasks from the front while other threads which have
+    // run out of tasks steal them from the back.
+    _Atomic uint64_t range;
+
+    // The number of nodes visited by this thread in the current search.
+    unsigned long long nodes;
+};
+
+// A pool of threads which search in parallel. The caller of ai_best_move()
+// is always the first worker.
+struct ai_pool
+{
+    struct ai *ai;
+    struct ai_worker workers[AI_MAX_THREADS];
+
+    // The tasks for the current search and the depth to search them to, or
+    // for rollouts the seed from which each task seeds its own generator.
+    struct ai_task tasks[MAX_TASKS];
+    int task_count;
+    int depth;
+    bool rollouts;
+    uint64_t seed;
+
+    // Threads wait on start until job changes, then the caller of
+    // ai_best_move() waits on done until running falls to zero.
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long job;
+    int running;
+    bool quit;
+};
+
+// The value of every possible row of tiles, made by init_ai_tables(). A board
+// is evaluated by summing the values of its rows and columns.
+static float heuristic_table[1 << ROW_BITS];
+
+/*
+ * Generates the tables used to evaluate boards. Must be called once, after
+ * init_tables() and before any searches.
+ */
+void init_ai_tables(void)
+{
+    for (int row = 0; row < 1 << ROW_BITS; row++)
+    {
+        int line[DIM];
+        for (int j = 0; j < DIM; j++)
+        {
+            line[j] = (row >> (TILE_BITS * j)) & TILE_MASK;
+        }
+
+        // Count empty tiles and tiles next to (or separated only by empty
+        // tiles from) an equal tile, and penalise large tiles.
+        double sum = 0;
+        int empty = 0;
+        int merges = 0;
+        int prev = 0;
+        int counter = 0;
+        for (int j = 0; j < DIM; j++)
+        {
+            sum += pow(line[j], SUM_POWER);
+            if (line[j] == 0)
+            {
+                empty++;
+            }
+            else
+            {
+                if (prev == line[j])
+                {
+                    counter++;
+                }
+                else if (counter > 0)
+                {
+                    merges += 1 + counter;
+                    counter = 0;
+                }
+                prev = line[j];
+            }
+        }
+        if (counter > 0)
+        {
+            merges += 1 + counter;
+        }
+
+        // Measure how far the row is from being monotonic in each direction.
+        double monotonicity_left = 0;
+        double monotonicity_right = 0;
+        for (int j = 1; j < DIM; j++)
+        {
+            double a = pow(line[j-1], MONOTONICITY_POWER);
+            double b = pow(line[j], MONOTONICITY_POWER);
+            if (line[j-1] > line[j])
+            {
+                monotonicity_left += a - b;
+            }
+            else
+            {
+                monotonicity_right += b - a;
+            }
+        }
+
+        heuristic_table[row] = LOST_PENALTY + EMPTY_WEIGHT * empty +
+            MERGES_WEIGHT * merges - SUM_WEIGHT * sum -
+            MONOTONICITY_WEIGHT * fmin(monotonicity_left, monotonicity_right);
+    }
+}
+
+/*
+ * Returns the value of a packed board according to the heuristic table.
+ */
+static double evaluate(board_t board)
+{
+    board_t columns = transpose(board);
+    double value = 0;
+    for (int i = 0; i < DIM; i++)
+    {
+        value += heuristic_table[(board >> (ROW_BITS * i)) & ROW_MASK];
+        value += heuristic_table[(columns >> (ROW_BITS * i)) & ROW_MASK];
+    }
+    return value;
+}
+
+/*
+ * Looks up the value a packed board was stored with in the transposition
+ * table. Returns true and stores the value in *value if it was stored in the
+ * current search at least as deeply as depth, otherwise returns false.
+ */
+static bool lookup(struct ai *ai, board_t board, int depth, double *value)
+{
+    // Fibonacci hashing spreads boards differing in a few tiles well.
+    struct ai_entry *entry =
+        &ai->table[(board * 0x9E3779B97F4A7C15ULL) >> (64 - AI_TABLE_BITS)];
+
+    uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+    if (!(data & ENTRY_VALID) || (check ^ data) != board ||
+        (uint16_t) data != ai->generation ||
+        (int) ((data >> 16) & ENTRY_DEPTH_MASK) < depth)
+    {
+        return false;
+    }
+
+    float f;
+    uint32_t bits = data >> 32;
+    memcpy(&f, &bits, sizeof f);
+    *value = f;
+    return true;
+}
+
+/*
+ * Stores the value of a packed board searched to depth in the transposition
+ * table.
+ */
+static void store(struct ai *ai, board_t board, int depth, double value)
+{
+    struct ai_entry *entry =
+        &ai->table[(board * 0x9E3779B97F4A7C15ULL) >> (64 - AI_TABLE_BITS)];
+
+    float f = value;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof bits);
+    uint64_t data = (uint64_t) bits << 32 | ENTRY_VALID |
+                    (uint64_t) depth << 16 | ai->generation;
+
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+    atomic_store_explicit(&entry->check, board ^ data, memory_order_relaxed);
+}
+
+static double chance_node(struct ai_worker *w, board_t board, int depth,
+                          double probability);
+
+/*
+ * Returns the value of a board on which we are about to move, i.e. the best
+ * value of the boards reached by moving in each direction. A board with no
+ * moves is worth nothing.
+ */
+static double max_node(struct ai_worker *w, board_t board, int depth,
+                       double probability)
+{
+    w->nodes++;
+
+    unsigned legal = legal_moves(board);
+    if (!legal)
+    {
+        return 0;
+    }
+
+    // Only make the moves which are legal, each of which changes the board.
+    // Boards can evaluate below zero, so any legal move beats none.
+    double best = -INFINITY;
+    for (; legal; legal &= legal - 1)
+    {
+        int score = 0;
+        board_t moved = move_board(board, __builtin_ctz(legal), &score);
+        double value = chance_node(w, moved, depth - 1, probability);
+        if (value > best)
+        {
+            best = value;
+        }
+    }
+    return best;
+}
+
+/*
+ * Returns the expected value of a board on which a new tile is about to be
+ * placed, averaging over every empty tile and both a '2' and a '4' tile.
+ */
+static double chance_node(struct ai_worker *w, board_t board, int depth,
+                          double probability)
+{
+    w->nodes++;
+
+    if (depth <= 0 || probability < PROBABILITY_CUTOFF)
+    {
+        return evaluate(board);
+    }
+
+    // Reuse the value of this board if already searched at least as deeply,
+    // by any thread.
+    double value;
+    if (lookup(w->pool->ai, board, depth, &value))
+    {
+        return value;
+    }
+
+    // Visit each empty tile by repeatedly taking the lowest set bit of the
+    // mask of empty tiles.
+    uint16_t mask = empty_mask(board);
+    int empty = __builtin_popcount(mask);
+    double total = 0;
+    for (; mask; mask &= mask - 1)
+    {
+        int k = __builtin_ctz(mask);
+        board_t two = board | (board_t) 1 << (TILE_BITS * k);
+        board_t four = board | (board_t) 2 << (TILE_BITS * k);
+        total += 0.9 * max_node(w, two, depth, probability * 0.9 / empty);
+        total += 0.1 * max_node(w, four, depth, probability * 0.1 / empty);
+    }
+    value = total / empty;
+
+    store(w->pool->ai, board, depth, value);
+    return value;
+}
+
+/*
+ * Plays random games to the end from a packed board just after one of our
+ * moves, returning the total score gained. Each game starts by placing a new
+ * tile, then each move is picked uniformly from the legal moves. New tiles are
+ * placed by a game holding the generator to use.
+ */
+static double rollout(struct ai_worker *w, board_t board, int playouts,
+                      struct game *game)
+{
+    /* The games are played in batches, all moving at once with move_boards().
+     * Finished games are swapped out of the end of the batch so the games
+     * still going are always the first live ones.
+     */
+    board_t boards[ROLLOUT_BATCH];
+    int scores[ROLLOUT_BATCH];
+    uint8_t dirs[ROLLOUT_BATCH];
+    double total = 0;
+
+    for (int played = 0; played < playouts; played += ROLLOUT_BATCH)
+    {
+        int live = playouts - played < ROLLOUT_BATCH ?
+                   playouts - played : ROLLOUT_BATCH;
+        // Each game starts with the tile the real game would place next.
+        for (int n = 0; n < live; n++)
+        {
+            game->board = board;
+            new_tile(game, true);
+            boards[n] = game->board;
+            scores[n] = 0;
+        }
+
+        while (live > 0)
+        {
+            for (int n = 0; n < live; )
+            {
+                unsigned legal = legal_moves(boards[n]);
+                if (!legal)
+                {
+                    total += scores[n];
+                    live--;
+                    boards[n] = boards[live];
+                    scores[n] = scores[live];
+                    continue;
+                }
+
+                for (uint32_t skip = rng_below(&game->rng,
+                                               __builtin_popcount(legal));
+                     skip; skip--)
+                {
+                    legal &= legal - 1;
+                }
+                dirs[n++] = __builtin_ctz(legal);
+            }
+
+            move_boards(boards, scores, dirs, live);
+            for (int n = 0; n < live; n++)
+            {
+                game->board = boards[n];
+                new_tile(game, true);
+                boards[n] = game->board;
+            }
+            w->nodes += live;
+        }
+    }
+    return total;
+}
+
+/*
+ * Takes the next task for a worker, first from the front of its own range of
+ * tasks, then from the back of the other workers' ranges. Returns the index
+ * of the task, or -1 once there are no tasks left.
+ */
+static int take_task(struct ai_worker *w)
+{
+    struct ai_pool *pool = w->pool;
+    uint64_t range = atomic_load(&w->range);
+    while ((uint32_t) (range >> 32) < (uint32_t) range)
+    {
+        if (atomic_compare_exchange_weak(&w->range, &range,
+                                         range + ((uint64_t) 1 << 32)))
+        {
+            return range >> 32;
+        }
+    }
+
+    // Our own range is empty, so look for a worker with tasks to steal,
+    // starting with the next worker along.
+    int index = w - pool->workers;
+    for (int n = 1; n < pool->ai->threads; n++)
+    {
+        struct ai_worker *victim =
+            &pool->workers[(index + n) % pool->ai->threads];
+        range = atomic_load(&victim->range);
+        while ((uint32_t) (range >> 32) < (uint32_t) range)
+        {
+            if (atomic_compare_exchange_weak(&victim->range, &range,
+                                             range - 1))
+            {
+                return (uint32_t) range - 1;
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+ * Does tasks for a worker until there are none left.
+ */
+static void run_tasks(struct ai_worker *w)
+{
+    struct ai_pool *pool = w->pool;
+    int task;
+    while ((task = take_task(w)) >= 0)
+    {
+        struct ai_task *t = &pool->tasks[task];
+        if (pool->rollouts)
+        {
+            // Seed each task separately so the games played do not depend
+            // on which thread plays them.
+            struct game game = { 0 };
+            rng_seed(&game.rng, pool->seed + task);
+            t->value = rollout(w, t->board, t->playouts, &game);
+        }
+        else
+        {
+            t->value = max_node(w, t->board, pool->depth, t->weight);
+        }
+    }
+}
+
+/*
+ * The main function of each thread in a pool besides the caller of
+ * ai_best_move(). Waits for each new search and takes part in it, until told
+ * to quit.
+ */
+static void *worker_main(void *arg)
+{
+    struct ai_worker *w = arg;
+    struct ai_pool *pool = w->pool;
+    unsigned long job = 0;
+
+    while (true)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->job == job && !pool->quit)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        job = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_tasks(w);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/*
+ * Prepares an ai to search the given number of moves ahead using the given
+ * number of threads, starting any extra threads needed. Returns true iff
+ * successful.
+ */
+bool ai_init(struct ai *ai, int depth, int threads)
+{
+    // The depth must fit in the transposition table's entries.
+    if (threads < 1 || threads > AI_MAX_THREADS || depth > ENTRY_DEPTH_MASK)
+    {
+        return false;
+    }
+
+    ai->depth = depth;
+    ai->threads = threads;
+    ai->generation = 0;
+    ai->nodes = 0;
+    ai->playouts = 0;
+    ai->seconds = 0;
+    ai->table = calloc((size_t) 1 << AI_TABLE_BITS, sizeof *ai->table);
+    ai->pool = aligned_alloc(_Alignof(struct ai_pool), sizeof *ai->pool);
+    if (!ai->table || !ai->pool)
+    {
+        free(ai->table);
+        free(ai->pool);
+        return false;
+    }
+
+    struct ai_pool *pool = ai->pool;
+    memset(pool, 0, sizeof *pool);
+    pool->ai = ai;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int n = 0; n < threads; n++)
+    {
+        pool->workers[n].pool = pool;
+    }
+
+    // Start the other threads, the first worker being the caller.
+    for (int n = 1; n < threads; n++)
+    {
+        if (pthread_create(&pool->workers[n].thread, NULL, worker_main,
+                           &pool->workers[n]) != 0)
+        {
+            ai->threads = n;
+            ai_free(ai);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Stops the threads and frees the memory used by an ai.
+ */
+void ai_free(struct ai *ai)
+{
+    struct ai_pool *pool = ai->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int n = 1; n < ai->threads; n++)
+    {
+        pthread_join(pool->workers[n].thread, NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+
+    free(ai->pool);
+    free(ai->table);
+    ai->pool = NULL;
+    ai->table = NULL;
+}
+
+/*
+ * Shares the tasks set up in the pool of an ai between its threads, takes
+ * part in doing them and returns once they are all done, totalling the nodes
+ * visited by every thread.
+ */
+static void run_search(struct ai *ai)
+{
+    struct ai_pool *pool = ai->pool;
+
+    // Share the tasks out evenly between the workers.
+    for (int n = 0; n < ai->threads; n++)
+    {
+        uint64_t first = (uint64_t) pool->task_count * n / ai->threads;
+        uint64_t last = (uint64_t) pool->task_count * (n + 1) / ai->threads;
+        atomic_store(&pool->workers[n].range, first << 32 | last);
+        pool->workers[n].nodes = 0;
+    }
+
+    // Wake the other threads, do tasks ourselves, then wait for the others
+    // to finish.
+    pthread_mutex_lock(&pool->lock);
+    pool->job++;
+    pool->running = ai->threads - 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(&pool->workers[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    ai->nodes = 0;
+    for (int n = 0; n < ai->threads; n++)
+    {
+        ai->nodes += pool->workers[n].nodes;
+    }
+}
+
+/*
+ * Searches for the best move on a packed board using expectimax, i.e.
+ * maximising over our moves and averaging over the new tiles which may be
+ * placed after them. Returns the best direction, or -1 if no move is
+ * possible.
+ */
+int ai_best_move(struct ai *ai, board_t board)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Start a new generation of table entries, only clearing the table when
+    // the generation wraps around.
+    if (++ai->generation == 0)
+    {
+        for (size_t n = 0; n < (size_t) 1 << AI_TABLE_BITS; n++)
+        {
+            atomic_store(&ai->table[n].data, 0);
+            atomic_store(&ai->table[n].check, 0);
+        }
+        ai->generation = 1;
+    }
+
+    // Split the search into a task for each new tile after each of our moves.
+    // Searching only one move ahead we just evaluate the boards after our
+    // moves, treating each as a single task of weight one.
+    struct ai_pool *pool = ai->pool;
+    pool->task_count = 0;
+    pool->depth = ai->depth - 1;
+    pool->rollouts = false;
+    double evaluated[4] = { 0 };
+    unsigned possible = legal_moves(board);
+    for (unsigned legal = possible; legal; legal &= legal - 1)
+    {
+        int dir = __builtin_ctz(legal);
+        int score = 0;
+        board_t moved = move_board(board, dir, &score);
+
+        if (ai->depth <= 1)
+        {
+            evaluated[dir] = evaluate(moved);
+            continue;
+        }
+
+        uint16_t mask = empty_mask(moved);
+        int empty = __builtin_popcount(mask);
+        for (; mask; mask &= mask - 1)
+        {
+            int k = __builtin_ctz(mask);
+            pool->tasks[pool->task_count++] = (struct ai_task) {
+                moved | (board_t) 1 << (TILE_BITS * k), dir, 0.9 / empty, 0 };
+            pool->tasks[pool->task_count++] = (struct ai_task) {
+                moved | (board_t) 2 << (TILE_BITS * k), dir, 0.1 / empty, 0 };
+        }
+    }
+
+    run_search(ai);
+
+    // Combine the tasks into the expected value of each move.
+    for (int n = 0; n < pool->task_count; n++)
+    {
+        evaluated[pool->tasks[n].dir] +=
+            pool->tasks[n].weight * pool->tasks[n].value;
+    }
+
+    // Boards can evaluate below zero, so any legal move beats none.
+    int best_dir = -1;
+    double best = -INFINITY;
+    for (int dir = LEFT; dir <= DOWN; dir++)
+    {
+        if ((possible >> dir & 1) && evaluated[dir] > best)
+        {
+            best = evaluated[dir];
+            best_dir = dir;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ai->seconds = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return best_dir;
+}
+
+/*
+ * Searches for the best move on a packed board using random rollouts, i.e.
+ * playing the given number of games to the end after each of our moves,
+ * picking every later move at random, and choosing the move with the best
+ * mean score. The games are seeded from rng, so the same generator state
+ * gives the same move. Returns the best direction, or -1 if no move is
+ * possible.
+ */
+int ai_rollout_move(struct ai *ai, board_t board, int playouts,
+                    struct rng *rng)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Split the games after each of our moves evenly into tasks.
+    struct ai_pool *pool = ai->pool;
+    pool->task_count = 0;
+    pool->rollouts = true;
+    pool->seed = rng_next(rng);
+    int tasks = playouts < ROLLOUT_TASKS ? playouts : ROLLOUT_TASKS;
+    double evaluated[4] = { 0 };
+    unsigned possible = legal_moves(board);
+    for (unsigned legal = possible; legal; legal &= legal - 1)
+    {
+        int dir = __builtin_ctz(legal);
+        int score = 0;
+        board_t moved = move_board(board, dir, &score);
+        evaluated[dir] = score;
+
+        for (int n = 0; n < tasks; n++)
+        {
+            pool->tasks[pool->task_count++] = (struct ai_task) {
+                moved, dir, 1.0 / playouts,
+                playouts * (n + 1) / tasks - playouts * n / tasks, 0 };
+        }
+    }
+
+    run_search(ai);
+    ai->playouts = (unsigned long long) playouts *
+                   __builtin_popcount(possible);
+
+    // Add the mean score of the games after each move to its own score.
+    for (int n = 0; n < pool->task_count; n++)
+    {
+        evaluated[pool->tasks[n].dir] +=
+            pool->tasks[n].weight * pool->tasks[n].value;
+    }
+
+    // Boards can evaluate below zero, so any legal move beats none.
+    int best_dir = -1;
+    double best = -INFINITY;
+    for (int dir = LEFT; dir <= DOWN; dir++)
+    {
+        if ((possible >> dir & 1) && evaluated[dir] > best)
+        {
+            best = evaluated[dir];
+            best_dir = dir;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ai->seconds = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return best_dir;
+}
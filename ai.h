@@ -0,0 +1,106 @@
+/**
+ * ai.h
+ *
+ * Header file for the automated player of nc_2048, part of libnc2048.
+ */
+
+#include "logic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef AI_H
+#define AI_H
+
+// The default number of moves the player looks ahead.
+#define AI_DEFAULT_DEPTH 3
+
+// The default number of random games played after each move by rollouts.
+#define AI_DEFAULT_PLAYOUTS 100
+
+// The transposition table has 2^AI_TABLE_BITS entries.
+#define AI_TABLE_BITS 20
+
+// The most threads a single search can use.
+#define AI_MAX_THREADS 256
+
+// An entry in the transposition table and a pool of threads which search in
+// parallel, defined in ai.c.
+struct ai_entry;
+struct ai_pool;
+
+// The state of an expectimax or rollout search. Each search splits into
+// tasks, one for each new tile which may be placed after each of our moves or
+// for a share of the random games played after each move, which are shared
+// between a pool of threads.
+struct ai
+{
+    // The number of moves to look ahead.
+    int depth;
+
+    // The number of threads used for each search, including the caller.
+    int threads;
+
+    // A transposition table caching the values of boards already searched,
+    // keyed on the packed board. All threads share the table, which needs no
+    // locks.
+    struct ai_entry *table;
+
+    // The threads searching alongside the caller of ai_best_move().
+    struct ai_pool *pool;
+
+    // Entries are only valid for the search with the matching generation,
+    // which saves clearing the table before each search.
+    uint16_t generation;
+
+    // The number of nodes visited (or for rollouts, moves made) by all
+    // threads, random games played and time taken in seconds by the most
+    // recent search.
+    unsigned long long nodes;
+    unsigned long long playouts;
+    double seconds;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions for the automated player, defined in ai.c.
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Generates the tables used to evaluate boards. Must be called once, after
+ * init_tables() and before any searches.
+ */
+void init_ai_tables(void);
+
+/*
+ * Prepares an ai to search the given number of moves ahead using the given
+ * number of threads, starting any extra threads needed. Returns true iff
+ * successful.
+ */
+bool ai_init(struct ai *ai, int depth, int threads);
+
+/*
+ * Stops the threads and frees the memory used by an ai.
+ */
+void ai_free(struct ai *ai);
+
+/*
+ * Searches for the best move on a packed board using expectimax, i.e.
+ * maximising over our moves and averaging over the new tiles which may be
+ * placed after them. Returns the best direction, or -1 if no move is
+ * possible.
+ */
+int ai_best_move(struct ai *ai, board_t board);
+
+/*
+ * Searches for the best move on a packed board using random rollouts, i.e.
+ * playing the given number of games to the end after each of our moves,
+ * picking every later move at random, and choosing the move with the best
+ * mean score. The games are seeded from rng, so the same generator state
+ * gives the same move. Returns the best direction, or -1 if no move is
+ * possible.
+ */
+int ai_rollout_move(struct ai *ai, board_t board, int playouts,
+                    struct rng *rng);
+
+#endif
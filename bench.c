@@ -0,0 +1,1049 @@
+/**
+ * bench.c
+ *
+ * Benchmarks for nc_2048's game logic. Build and run with
+ * $ make bench
+ *
+ * Each of the game's hot paths is timed over corpora of mid-game and late-game
+ * boards, reporting nanoseconds and cycles per call and the proportion of
+ * branches mispredicted, next to reference implementations: the original
+ * logic using a two-dimensional array of tiles, and column moves which walk
+ * the packed board rather than transposing it. Finally, searches by the
+ * automated player are timed with doubling numbers of threads.
+ *
+ * We include logic.c directly so that the benchmarks can reach the static
+ * move tables used by reference implementations.
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 500
+
+#include "logic.c"
+#include "ai.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Number of boards in each corpus and the number of passes over them.
+#define CORPUS_SIZE 4096
+#define PASSES 500
+
+// Mid-game boards have a largest tile of 256 or 512, late-game boards have a
+// largest tile of at least 1024.
+#define MID_GAME 8
+#define LATE_GAME 10
+
+// Depth of the searches used to play the games the corpora are taken from.
+#define CORPUS_DEPTH 2
+
+// Depth and number of boards for timing searches by the automated player.
+#define AI_DEPTH 6
+#define AI_BOARDS 16
+
+// The original undo stack held this many moves, plus one.
+#define ARRAY_UNDO_CAPACITY 4
+
+// The number of games played to check undoing moves, and the most moves
+// checked in each.
+#define HISTORY_GAMES 100
+#define HISTORY_MOVES 4096
+
+// The original game state using a two-dimensional array of tile values.
+struct array_game
+{
+    int tiles[DIM][DIM];
+    int score;
+    struct
+    {
+        int tiles[ARRAY_UNDO_CAPACITY][DIM][DIM];
+        int score[ARRAY_UNDO_CAPACITY];
+        int top;
+        int size;
+    } undo;
+};
+
+// A corpus of boards in both forms.
+struct corpus
+{
+    const char *name;
+    board_t boards[CORPUS_SIZE];
+    int tiles[CORPUS_SIZE][DIM][DIM];
+};
+
+static struct corpus mid = { "mid" };
+static struct corpus late = { "late" };
+
+static struct game g;
+static struct array_game a;
+
+// A batch of boards for move_boards(), each moving in a random direction.
+static board_t batch_boards[CORPUS_SIZE];
+static int batch_scores[CORPUS_SIZE];
+static uint8_t batch_dirs[CORPUS_SIZE];
+
+// Accumulate results here so the compiler cannot discard the work done.
+static volatile board_t sink;
+
+// File descriptors for hardware performance counters, or -1 if unavailable.
+static int cycles_fd = -1;
+static int branches_fd = -1;
+static int misses_fd = -1;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Reference implementations.
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns column j of a packed board as a packed row.
+ */
+static uint16_t get_column(board_t board, int j)
+{
+    uint16_t column = 0;
+    for (int i = 0; i < DIM; i++)
+    {
+        column |= ((board >> (ROW_BITS * i + TILE_BITS * j)) & TILE_MASK)
+                  << (TILE_BITS * i);
+    }
+    return column;
+}
+
+/*
+ * Returns a packed board with column j replaced by a packed row.
+ */
+static board_t set_column(board_t board, int j, uint16_t column)
+{
+    for (int i = 0; i < DIM; i++)
+    {
+        int shift = ROW_BITS * i + TILE_BITS * j;
+        board &= ~((board_t) TILE_MASK << shift);
+        board |= (board_t) ((column >> (TILE_BITS * i)) & TILE_MASK) << shift;
+    }
+    return board;
+}
+
+/*
+ * up() walking the board column by column rather than transposing.
+ */
+static bool strided_up(struct game *g)
+{
+    board_t before = g->board;
+    board_t after = before;
+    for (int j = 0; j < DIM; j++)
+    {
+        uint16_t column = get_column(before, j);
+        after = set_column(after, j, move_table[LEFT][column]);
+        g->score += score_table[LEFT][column];
+    }
+    g->board = after;
+    return after != before;
+}
+
+/*
+ * down() walking the board column by column rather than transposing.
+ */
+static bool strided_down(struct game *g)
+{
+    board_t before = g->board;
+    board_t after = before;
+    for (int j = 0; j < DIM; j++)
+    {
+        uint16_t column = get_column(before, j);
+        after = set_column(after, j, move_table[RIGHT][column]);
+        g->score += score_table[RIGHT][column];
+    }
+    g->board = after;
+    return after != before;
+}
+
+// The original array implementations of the game's functions.
+
+static bool array_left(struct array_game *a)
+{
+    bool new_tile_needed = false;
+
+    for (int i = 0; i < DIM; i++)
+    {
+        int zeros = 0;
+        int unmerged = 0;
+
+        for (int j = 0; j < DIM; j++)
+        {
+            if (a->tiles[i][j] == 0)
+            {
+                zeros++;
+            }
+            else if (a->tiles[i][j] == unmerged)
+            {
+                a->tiles[i][j-zeros-1] = unmerged * 2;
+                a->score += unmerged * 2;
+                new_tile_needed = true;
+                zeros++;
+                unmerged = 0;
+            }
+            else if (unmerged)
+            {
+                if (zeros)
+                {
+                    new_tile_needed = true;
+                }
+                a->tiles[i][j-zeros-1] = unmerged;
+                unmerged = a->tiles[i][j];
+            }
+            else
+            {
+                unmerged = a->tiles[i][j];
+            }
+        }
+
+        if (unmerged)
+        {
+            if (a->tiles[i][DIM-zeros-1] != unmerged)
+            {
+                new_tile_needed = true;
+                a->tiles[i][DIM-zeros-1] = unmerged;
+            }
+        }
+
+        while (zeros)
+        {
+            a->tiles[i][DIM-zeros] = 0;
+            zeros--;
+        }
+    }
+
+    return new_tile_needed;
+}
+
+static bool array_right(struct array_game *a)
+{
+    bool new_tile_needed = false;
+    for (int i = 0; i < DIM; i++)
+    {
+        int zeros = 0;
+        int unmerged = 0;
+        for (int j = DIM - 1; j >= 0; j--)
+        {
+            if (a->tiles[i][j] == 0)
+            {
+                zeros++;
+            }
+            else if (a->tiles[i][j] == unmerged)
+            {
+                a->tiles[i][j+zeros+1] = unmerged * 2;
+                a->score += unmerged * 2;
+                new_tile_needed = true;
+                zeros++;
+                unmerged = 0;
+            }
+            else if (unmerged)
+            {
+                if (zeros)
+                {
+                    new_tile_needed = true;
+                }
+                a->tiles[i][j+zeros+1] = unmerged;
+                unmerged = a->tiles[i][j];
+            }
+            else
+            {
+                unmerged = a->tiles[i][j];
+            }
+        }
+        if (unmerged)
+        {
+            if (a->tiles[i][zeros] != unmerged)
+            {
+                new_tile_needed = true;
+                a->tiles[i][zeros] = unmerged;
+            }
+        }
+        while (zeros)
+        {
+            a->tiles[i][zeros-1] = 0;
+            zeros--;
+        }
+    }
+    return new_tile_needed;
+}
+
+static bool array_up(struct array_game *a)
+{
+    bool new_tile_needed = false;
+    for (int j = 0; j < DIM; j++)
+    {
+        int zeros = 0;
+        int unmerged = 0;
+        for (int i = 0; i < DIM; i++)
+        {
+            if (a->tiles[i][j] == 0)
+            {
+                zeros++;
+            }
+            else if (a->tiles[i][j] == unmerged)
+            {
+                a->tiles[i-zeros-1][j] = unmerged * 2;
+                a->score += unmerged * 2;
+                new_tile_needed = true;
+                zeros++;
+                unmerged = 0;
+            }
+            else if (unmerged)
+            {
+                if (zeros)
+                {
+                    new_tile_needed = true;
+                }
+                a->tiles[i-zeros-1][j] = unmerged;
+                unmerged = a->tiles[i][j];
+            }
+            else
+            {
+                unmerged = a->tiles[i][j];
+            }
+        }
+        if (unmerged)
+        {
+            if (a->tiles[DIM-zeros-1][j] != unmerged)
+            {
+                new_tile_needed = true;
+                a->tiles[DIM-zeros-1][j] = unmerged;
+            }
+        }
+        while (zeros)
+        {
+            a->tiles[DIM-zeros][j] = 0;
+            zeros--;
+        }
+    }
+    return new_tile_needed;
+}
+
+static bool array_down(struct array_game *a)
+{
+    bool new_tile_needed = false;
+    for (int j = 0; j < DIM; j++)
+    {
+        int zeros = 0;
+        int unmerged = 0;
+        for (int i = DIM - 1; i >= 0; i--)
+        {
+            if (a->tiles[i][j] == 0)
+            {
+                zeros++;
+            }
+            else if (a->tiles[i][j] == unmerged)
+            {
+                a->tiles[i+zeros+1][j] = unmerged * 2;
+                a->score += unmerged * 2;
+                new_tile_needed = true;
+                zeros++;
+                unmerged = 0;
+            }
+            else if (unmerged)
+            {
+                if (zeros)
+                {
+                    new_tile_needed = true;
+                }
+                a->tiles[i+zeros+1][j] = unmerged;
+                unmerged = a->tiles[i][j];
+            }
+            else
+            {
+                unmerged = a->tiles[i][j];
+            }
+        }
+        if (unmerged)
+        {
+            if (a->tiles[zeros][j] != unmerged)
+            {
+                new_tile_needed = true;
+                a->tiles[zeros][j] = unmerged;
+            }
+        }
+        while (zeros)
+        {
+            a->tiles[zeros-1][j] = 0;
+            zeros--;
+        }
+    }
+    return new_tile_needed;
+}
+
+static void array_new_tile(struct array_game *a, bool random_tiles)
+{
+    int zeros_count = 0;
+    for (int i = 0; i < DIM; i++)
+    {
+        for (int j = 0; j < DIM; j++)
+        {
+            if (a->tiles[i][j] == 0)
+            {
+                zeros_count++;
+            }
+        }
+    }
+
+    int new_placement;
+    int tile;
+    if (random_tiles)
+    {
+        new_placement = (int) (drand48() * zeros_count);
+        tile = drand48() < 0.9 ? 2 : 4;
+    }
+    else
+    {
+        new_placement = 0;
+        tile = 2;
+    }
+
+    zeros_count = 0;
+    for (int i = 0; i < DIM; i++)
+    {
+        for (int j = 0; j < DIM; j++)
+        {
+            if (a->tiles[i][j] == 0)
+            {
+                if (zeros_count == new_placement)
+                {
+                    a->tiles[i][j] = tile;
+                    return;
+                }
+                else
+                {
+                    zeros_count++;
+                }
+            }
+        }
+    }
+}
+
+static bool array_move_available(struct array_game *a)
+{
+    for (int i = 0; i < DIM; i++)
+    {
+        for (int j = 0; j < DIM; j++)
+        {
+            if (a->tiles[i][j] == 0)
+            {
+                return true;
+            }
+            if (i < DIM - 1 && a->tiles[i][j] == a->tiles[i+1][j])
+            {
+                return true;
+            }
+            if (j < DIM - 1 && a->tiles[i][j] == a->tiles[i][j+1])
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void array_push_undo(struct array_game *a)
+{
+    a->undo.top = (a->undo.top + 1) % ARRAY_UNDO_CAPACITY;
+    if (a->undo.size < ARRAY_UNDO_CAPACITY)
+    {
+        a->undo.size++;
+    }
+
+    memcpy(a->undo.tiles[a->undo.top], a->tiles, sizeof a->tiles);
+    a->undo.score[a->undo.top] = a->score;
+}
+
+static bool array_pop_undo(struct array_game *a)
+{
+    if (a->undo.size <= 1)
+    {
+        return false;
+    }
+
+    int index = a->undo.top ? a->undo.top - 1 : ARRAY_UNDO_CAPACITY - 1;
+
+    memcpy(a->tiles, a->undo.tiles[index], sizeof a->tiles);
+    a->score = a->undo.score[index];
+
+    a->undo.top = (a->undo.top + ARRAY_UNDO_CAPACITY - 1) % ARRAY_UNDO_CAPACITY;
+    a->undo.size--;
+
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Corpora of boards.
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Adds a packed board to a corpus unless the corpus is full.
+ */
+static void add_board(struct corpus *c, int *count, board_t board)
+{
+    if (*count == CORPUS_SIZE)
+    {
+        return;
+    }
+    c->boards[*count] = board;
+    for (int i = 0; i < DIM; i++)
+    {
+        for (int j = 0; j < DIM; j++)
+        {
+            c->tiles[*count][i][j] = tile_value(board, i, j);
+        }
+    }
+    (*count)++;
+}
+
+/*
+ * Fills the corpora with boards from games played by a shallow automated
+ * player, so the boards look like real positions rather than random noise.
+ */
+static bool make_corpora(void)
+{
+    struct ai ai;
+    if (!ai_init(&ai, CORPUS_DEPTH, 1))
+    {
+        return false;
+    }
+
+    rng_seed(&g.rng, 2048);
+    int mid_count = 0;
+    int late_count = 0;
+    while (mid_count < CORPUS_SIZE || late_count < CORPUS_SIZE)
+    {
+        reset_game(&g, true);
+        int dir;
+        while ((dir = ai_best_move(&ai, g.board)) >= 0)
+        {
+            g.board = move_board(g.board, dir, &g.score);
+            new_tile(&g, true);
+
+            int max = max_exponent(g.board);
+            if (max >= LATE_GAME)
+            {
+                add_board(&late, &late_count, g.board);
+            }
+            else if (max >= MID_GAME)
+            {
+                add_board(&mid, &mid_count, g.board);
+            }
+        }
+    }
+
+    ai_free(&ai);
+    return true;
+}
+
+/*
+ * Checks an implementation of move_boards() agrees with move_board() on every
+ * board of a corpus, moving in random directions and leaving some boards over
+ * at the end of the batch. Returns true iff they all agree.
+ */
+static bool check_batch(const struct corpus *c,
+                        void (*move)(board_t *, int *, const uint8_t *, size_t))
+{
+    for (int n = 0; n < CORPUS_SIZE; n++)
+    {
+        batch_boards[n] = c->boards[n];
+        batch_scores[n] = n;
+    }
+    move(batch_boards, batch_scores, batch_dirs, CORPUS_SIZE - 3);
+
+    for (int n = 0; n < CORPUS_SIZE; n++)
+    {
+        int score = n;
+        board_t board = n < CORPUS_SIZE - 3 ?
+            move_board(c->boards[n], batch_dirs[n], &score) : c->boards[n];
+        if (batch_boards[n] != board || batch_scores[n] != score)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Checks undoing each move of games played with random moves restores the
+ * board and score from before the move, and redoing them all again restores
+ * those after each move. Returns true iff it does.
+ */
+static bool check_history(void)
+{
+    static board_t boards[HISTORY_MOVES + 1];
+    static int scores[HISTORY_MOVES + 1];
+
+    struct game h;
+    init_game(&h);
+    rng_seed(&h.rng, 2048);
+    bool ok = true;
+    for (int n = 0; n < HISTORY_GAMES && ok; n++)
+    {
+        reset_game(&h, true);
+        int moves = 0;
+        unsigned legal;
+        while ((legal = legal_moves(h.board)) && moves < HISTORY_MOVES)
+        {
+            boards[moves] = h.board;
+            scores[moves++] = h.score;
+            for (uint32_t skip = rng_below(&h.rng, __builtin_popcount(legal));
+                 skip; skip--)
+            {
+                legal &= legal - 1;
+            }
+            int dir = __builtin_ctz(legal);
+            h.board = move_board(h.board, dir, &h.score);
+            ok = ok && push_undo(&h, dir, new_tile(&h, true));
+        }
+        boards[moves] = h.board;
+        scores[moves] = h.score;
+
+        for (int m = moves - 1; ok && m >= 0; m--)
+        {
+            ok = pop_undo(&h) && h.board == boards[m] && h.score == scores[m];
+        }
+        ok = ok && !pop_undo(&h);
+
+        for (int m = 1; ok && m <= moves; m++)
+        {
+            ok = redo(&h) && h.board == boards[m] && h.score == scores[m];
+        }
+        ok = ok && !redo(&h);
+    }
+
+    free_game(&h);
+    return ok;
+}
+
+/*
+ * Checks the game's functions agree with the reference implementations on
+ * every board of a corpus. Returns true iff they all agree.
+ */
+static bool check_corpus(const struct corpus *c)
+{
+    bool (*moves[4])(struct game *) = { left, right, up, down };
+    bool (*array_moves[4])(struct array_game *) =
+        { array_left, array_right, array_up, array_down };
+    bool (*strided_moves[4])(struct game *) =
+        { NULL, NULL, strided_up, strided_down };
+
+    for (int n = 0; n < CORPUS_SIZE; n++)
+    {
+        memcpy(a.tiles, c->tiles[n], sizeof a.tiles);
+        g.board = c->boards[n];
+        if (array_move_available(&a) != move_available(&g))
+        {
+            return false;
+        }
+
+        unsigned legal = legal_moves(c->boards[n]);
+        for (int dir = LEFT; dir <= DOWN; dir++)
+        {
+            g.board = c->boards[n];
+            g.score = 0;
+            bool moved = moves[dir](&g);
+            board_t board = g.board;
+            int score = g.score;
+            if ((legal >> dir & 1) != moved)
+            {
+                return false;
+            }
+
+            // Trying the move must agree without changing the game.
+            g.board = c->boards[n];
+            g.score = 0;
+            board_t tried = 0;
+            int tried_score = 0;
+            if (try_move(&g, dir, &tried, &tried_score) != moved ||
+                (moved && (tried != board || tried_score != score)) ||
+                g.board != c->boards[n] || g.score != 0)
+            {
+                return false;
+            }
+
+            memcpy(a.tiles, c->tiles[n], sizeof a.tiles);
+            a.score = 0;
+            if (array_moves[dir](&a) != moved || a.score != score)
+            {
+                return false;
+            }
+            for (int i = 0; i < DIM; i++)
+            {
+                for (int j = 0; j < DIM; j++)
+                {
+                    if (a.tiles[i][j] != tile_value(board, i, j))
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            if (strided_moves[dir])
+            {
+                g.board = c->boards[n];
+                g.score = 0;
+                if (strided_moves[dir](&g) != moved || g.board != board ||
+                    g.score != score)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Check each implementation of move_boards() this processor can run.
+    if (!check_batch(c, move_boards_scalar))
+    {
+        return false;
+    }
+#ifdef HAVE_X86
+    if (__builtin_cpu_supports("avx2") && !check_batch(c, move_boards_avx2))
+    {
+        return false;
+    }
+#endif
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Passes over a corpus.
+////////////////////////////////////////////////////////////////////////////////
+
+// Each pass calls one function on every board of a corpus, first loading the
+// board into the game, and returns a value depending on the results.
+
+#define PACKED_PASS(name, call)                                                \
+static board_t name(const struct corpus *c)                                    \
+{                                                                              \
+    board_t acc = 0;                                                           \
+    for (int n = 0; n < CORPUS_SIZE; n++)                                      \
+    {                                                                          \
+        g.board = c->boards[n];                                                \
+        acc ^= (call);                                                         \
+        acc ^= g.board;                                                        \
+    }                                                                          \
+    return acc;                                                                \
+}
+
+#define ARRAY_PASS(name, call)                                                 \
+static board_t name(const struct corpus *c)                                    \
+{                                                                              \
+    board_t acc = 0;                                                           \
+    for (int n = 0; n < CORPUS_SIZE; n++)                                      \
+    {                                                                          \
+        memcpy(a.tiles, c->tiles[n], sizeof a.tiles);                          \
+        acc ^= (call);                                                         \
+        acc ^= a.tiles[0][0];                                                  \
+    }                                                                          \
+    return acc;                                                                \
+}
+
+// Moves every board of a corpus at once, each in its direction from the
+// batch, using one implementation of move_boards().
+#define BATCH_PASS(name, move)                                                 \
+static board_t name(const struct corpus *c)                                    \
+{                                                                              \
+    memcpy(batch_boards, c->boards, sizeof batch_boards);                      \
+    move(batch_boards, batch_scores, batch_dirs, CORPUS_SIZE);                 \
+    board_t acc = 0;                                                           \
+    for (int n = 0; n < CORPUS_SIZE; n++)                                      \
+    {                                                                          \
+        acc ^= batch_boards[n];                                                \
+    }                                                                          \
+    return acc;                                                                \
+}
+
+PACKED_PASS(pass_left, left(&g))
+PACKED_PASS(pass_right, right(&g))
+PACKED_PASS(pass_up, up(&g))
+PACKED_PASS(pass_down, down(&g))
+PACKED_PASS(pass_strided_up, strided_up(&g))
+PACKED_PASS(pass_strided_down, strided_down(&g))
+PACKED_PASS(pass_new_tile, (new_tile(&g, true), 0))
+PACKED_PASS(pass_move_available, move_available(&g))
+PACKED_PASS(pass_legal_moves, legal_moves(g.board))
+// Undoing replays the moves since the last keyframe, so we undo from varying
+// lengths of the history built up by pushing, which is timed first.
+PACKED_PASS(pass_push_undo,
+            push_undo(&g, n & 3, __builtin_ctzll(g.board) / TILE_BITS))
+PACKED_PASS(pass_pop_undo, (g.history.length = n + 1, pop_undo(&g)))
+
+BATCH_PASS(pass_move_boards, move_boards)
+BATCH_PASS(pass_move_boards_scalar, move_boards_scalar)
+
+ARRAY_PASS(pass_array_left, array_left(&a))
+ARRAY_PASS(pass_array_right, array_right(&a))
+ARRAY_PASS(pass_array_up, array_up(&a))
+ARRAY_PASS(pass_array_down, array_down(&a))
+ARRAY_PASS(pass_array_new_tile, (array_new_tile(&a, true), 0))
+ARRAY_PASS(pass_array_move_available, array_move_available(&a))
+ARRAY_PASS(pass_array_push_undo, (array_push_undo(&a), 0))
+ARRAY_PASS(pass_array_pop_undo,
+           (a.undo.size = ARRAY_UNDO_CAPACITY, array_pop_undo(&a)))
+
+// The benchmarks to run, in order.
+static const struct
+{
+    const char *name;
+    board_t (*pass)(const struct corpus *c);
+}
+benchmarks[] = {
+    { "left", pass_left },
+    { "left (array)", pass_array_left },
+    { "right", pass_right },
+    { "right (array)", pass_array_right },
+    { "up", pass_up },
+    { "up (strided)", pass_strided_up },
+    { "up (array)", pass_array_up },
+    { "down", pass_down },
+    { "down (strided)", pass_strided_down },
+    { "down (array)", pass_array_down },
+    { "move_boards", pass_move_boards },
+    { "move_boards (scalar)", pass_move_boards_scalar },
+    { "new_tile", pass_new_tile },
+    { "new_tile (array)", pass_array_new_tile },
+    { "move_available", pass_move_available },
+    { "move_available (array)", pass_array_move_available },
+    { "legal_moves", pass_legal_moves },
+    { "push_undo", pass_push_undo },
+    { "push_undo (array)", pass_array_push_undo },
+    { "pop_undo", pass_pop_undo },
+    { "pop_undo (array)", pass_array_pop_undo },
+};
+
+#define BENCHMARK_COUNT (sizeof benchmarks / sizeof benchmarks[0])
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Timing.
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the current time in nanoseconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Opens a hardware performance counter for this process, returning its file
+ * descriptor or -1 if it cannot be opened.
+ */
+static int open_counter(unsigned long long config)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof attr;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/*
+ * Resets and starts a performance counter, if it is open.
+ */
+static void start_counter(int fd)
+{
+#ifdef __linux__
+    if (fd >= 0)
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+/*
+ * Stops a performance counter and returns its value, or -1 if it is not open.
+ */
+static double stop_counter(int fd)
+{
+#ifdef __linux__
+    if (fd >= 0)
+    {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        unsigned long long count;
+        if (read(fd, &count, sizeof count) == sizeof count)
+        {
+            return count;
+        }
+    }
+#endif
+    return -1;
+}
+
+/*
+ * Returns the processor's time stamp counter, or 0 where there is none.
+ */
+static unsigned long long timestamp(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Times a benchmark over a corpus and prints the nanoseconds and cycles per
+ * call and the proportion of branches mispredicted. Without performance
+ * counters, cycles are measured with the time stamp counter where there is
+ * one, and mispredicted branches are not measured.
+ */
+static void run_benchmark(int b, const struct corpus *c)
+{
+    board_t acc = 0;
+    double calls = (double) PASSES * CORPUS_SIZE;
+
+    start_counter(cycles_fd);
+    start_counter(branches_fd);
+    start_counter(misses_fd);
+    unsigned long long start_stamp = timestamp();
+    double start = now();
+
+    for (int p = 0; p < PASSES; p++)
+    {
+        acc ^= benchmarks[b].pass(c);
+    }
+
+    double elapsed = now() - start;
+    unsigned long long stamps = timestamp() - start_stamp;
+    double misses = stop_counter(misses_fd);
+    double branches = stop_counter(branches_fd);
+    double cycles = stop_counter(cycles_fd);
+    sink = acc;
+
+    if (cycles < 0)
+    {
+        cycles = stamps;
+    }
+
+    printf("%-24s %-5s %9.2f", benchmarks[b].name, c->name, elapsed / calls);
+    if (cycles > 0)
+    {
+        printf(" %10.1f", cycles / calls);
+    }
+    else
+    {
+        printf(" %10s", "n/a");
+    }
+    if (misses >= 0 && branches > 0)
+    {
+        printf(" %9.2f%%\n", 100 * misses / branches);
+    }
+    else
+    {
+        printf(" %10s\n", "n/a");
+    }
+}
+
+/*
+ * Times searches by the automated player over part of the late-game corpus
+ * with doubling numbers of threads, up to the number of processors, and
+ * prints the speedup over a single thread.
+ */
+static void bench_ai(void)
+{
+    int processors = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    double single = 0;
+    for (int threads = 1; threads <= processors && threads <= AI_MAX_THREADS;
+         threads *= 2)
+    {
+        struct ai ai;
+        if (!ai_init(&ai, AI_DEPTH, threads))
+        {
+            fprintf(stderr, "Error starting the automated player!\n");
+            return;
+        }
+
+        unsigned long long nodes = 0;
+        double start = now();
+        for (int n = 0; n < AI_BOARDS; n++)
+        {
+            ai_best_move(&ai, late.boards[n * (CORPUS_SIZE / AI_BOARDS)]);
+            nodes += ai.nodes;
+        }
+        double elapsed = now() - start;
+        ai_free(&ai);
+
+        if (threads == 1)
+        {
+            single = elapsed;
+        }
+        printf("ai depth %i, %3i threads %12.0f nodes/s %6.2fx speedup\n",
+               AI_DEPTH, threads, nodes / elapsed * 1e9, single / elapsed);
+    }
+}
+
+int main(void)
+{
+    init_tables();
+    init_ai_tables();
+    init_game(&g);
+    srand48(2048);
+    for (int n = 0; n < CORPUS_SIZE; n++)
+    {
+        batch_dirs[n] = lrand48() % 4;
+    }
+
+    if (!make_corpora())
+    {
+        fprintf(stderr, "Error starting the automated player!\n");
+        return 1;
+    }
+
+    // Check the reference implementations agree with the game's before
+    // timing anything.
+    if (!check_corpus(&mid) || !check_corpus(&late) || !check_history())
+    {
+        fprintf(stderr, "Reference implementations disagree with the game!\n");
+        return 1;
+    }
+
+    cycles_fd = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+    branches_fd = open_counter(PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+    misses_fd = open_counter(PERF_COUNT_HW_BRANCH_MISSES);
+    if (cycles_fd < 0)
+    {
+        printf("Performance counters unavailable, cycles are measured with"
+               " the time stamp counter.\n\n");
+    }
+
+    printf("%-24s %-5s %9s %10s %10s\n", "function", "board", "ns/op",
+           "cycles/op", "br-miss");
+    for (size_t b = 0; b < BENCHMARK_COUNT; b++)
+    {
+        run_benchmark(b, &mid);
+        run_benchmark(b, &late);
+    }
+    printf("\n");
+
+    bench_ai();
+
+    free_game(&g);
+    return 0;
+}
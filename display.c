@@ -10,9 +10,21 @@
 #include <ncurses.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
 
 extern struct game g;
 
+// Track the x,y co-ordinates for the top left of the board to aid functions
+// that draw on the window.
+static int board_x, board_y;
+
+// The board as last drawn by draw_tiles, so only tiles which have changed
+// since are drawn again, unless the whole board must be drawn.
+static board_t drawn_board;
+static bool drawn_valid = false;
+
 /*
  * Draws borders at the top and bottom of window.
  */
@@ -67,24 +79,29 @@ void draw_grid(void)
     getmaxyx(stdscr, maxy, maxx);
 
     // Determine top-left corner of board.
-    g.y = maxy/2 - 9;
-    g.x = maxx/2 - 40;
+    board_y = maxy/2 - 9;
+    board_x = maxx/2 - 40;
+
+    // The board may have moved and the grid covers any tiles drawn before,
+    // so every tile must be drawn again.
+    drawn_valid = false;
 
     // Write the grid to the window.
     for (int i = 0; i < DIM; i++)
     {
-        mvaddstr(g.y + 0 + 4 * i, g.x, "+---------+---------+---------+---------+");
+        mvaddstr(board_y + 0 + 4 * i, board_x, "+---------+---------+---------+---------+");
         for (int j = 1; j < DIM; j++)
         {
-            mvaddstr(g.y + j + 4 * i, g.x, "|         |         |         |         |");
+            mvaddstr(board_y + j + 4 * i, board_x, "|         |         |         |         |");
         }
     }
-    mvaddstr(g.y + 16, g.x, "+---------+---------+---------+---------+");
+    mvaddstr(board_y + 16, board_x, "+---------+---------+---------+---------+");
 }
 
 /*
- * Draws the game's tiles. Only call after draw_grid has been called at least
- * once.
+ * Draws the game's tiles, skipping those unchanged since they were last drawn.
+ * The screen is updated by the next call to refresh() or doupdate(). Only call
+ * after draw_grid has been called at least once.
  */
 void draw_tiles(void)
 {
@@ -96,31 +113,29 @@ void draw_tiles(void)
     {
         for (int j = 0; j < DIM; j++)
         {
-            // Determine a colour number based on the tile number.
-            int colour_num = 0;
-            int tile_num = g.tiles[i][j];
+            // Use log_2 of the tile number, as stored on the packed board, to
+            // get a colour number.
+            int colour_num = tile_exponent(g.board, i, j);
+            int tile_num = tile_value(g.board, i, j);
 
-            // Use log_2(tile_num) to get a colour number.
-            if (tile_num)
+            // A typical move changes only a few tiles, so leave the rest.
+            if (drawn_valid && colour_num == tile_exponent(drawn_board, i, j))
             {
-                while (tile_num >>= 1)
-                {
-                    colour_num++;
-                }
+                continue;
             }
 
             // Apply the colour pair.
             attron(COLOR_PAIR(colour_num));
 
             // Write a line of spaces.
-            move(g.y + 1 + 4*i, g.x + 1 + 10*j);
+            move(board_y + 1 + 4*i, board_x + 1 + 10*j);
             for (int k = 0; k < 9; k++)
                 addch(' ');
 
             // Determine a number string for the tile number.
             char num_str[6] = {'\0'};
-            if (g.tiles[i][j] != 0)
-                sprintf(num_str, "%i", g.tiles[i][j]);
+            if (tile_num != 0)
+                sprintf(num_str, "%i", tile_num);
             int len = strlen(num_str);
 
             // A prefix and suffix to centre the number string.
@@ -129,7 +144,7 @@ void draw_tiles(void)
 
             // Write spaces for the prefix, the number string, then spaces for
             // the suffix.
-            move(g.y + 2 + 4*i, g.x + 1 + 10*j);
+            move(board_y + 2 + 4*i, board_x + 1 + 10*j);
             for (int k = 0; k < prefix; k++)
                 addch(' ');
             addstr(num_str);
@@ -138,14 +153,17 @@ void draw_tiles(void)
 
             // Write another line of spaces.
             for (int k = 0; k < 9; k++)
-                mvaddch(g.y + 3 + 4*i, g.x + 1 + k + 10*j, ' ');
+                mvaddch(board_y + 3 + 4*i, board_x + 1 + k + 10*j, ' ');
 
             // Disable colour.
             attroff(COLOR_PAIR(colour_num));
         }
     }
     attroff(A_BOLD);
-    refresh();
+    wnoutrefresh(stdscr);
+
+    drawn_board = g.board;
+    drawn_valid = true;
 }
 
 /*
@@ -155,8 +173,8 @@ void draw_tiles(void)
 void draw_logo(void)
 {
     // Determine starting coordinates for logo.
-    int logo_x = g.x + 44;
-    int y = g.y + 1;
+    int logo_x = board_x + 44;
+    int y = board_y + 1;
 
     // Clear the area.
     for (int r = 0; r < MAX_HEIGHT_LOGO_HELP; r++)
@@ -190,8 +208,8 @@ void draw_logo(void)
 void display_help(void)
 {
     // Determine starting coordinates for help text.
-    int x = g.x + 44;
-    int y = g.y + 1;
+    int x = board_x + 44;
+    int y = board_y + 1;
 
     // Clear the area.
     for (int r = 0; r < MAX_HEIGHT_LOGO_HELP; r++)
@@ -217,9 +235,10 @@ void display_help(void)
                              "Q - Quit the game",
                              "D - Deterministic mode",
                              "R - Random mode",
-                             "U - Undo (up to three moves)",
-                             "S - Save current game",
-                             "L - Load previously saved game" };
+                             "U/Y - Undo/redo a move",
+                             "S - Save current game in a slot",
+                             "L - Load game from a slot",
+                             "A - Ask for a hint" };
 
     // Enable colour.
     attron(COLOR_PAIR(PAIR_INFO));
@@ -239,11 +258,11 @@ void display_help(void)
  * Displays a message below and to the right of the game board. Only call after
  * draw_grid has been called at least once.
  */
-void display_message(char *s)
+void display_message(const char *s)
 {
     // Determine starting coordinates for message text.
-    int x = g.x + 44;
-    int y = g.y + 18;
+    int x = board_x + 44;
+    int y = board_y + 18;
 
     // Clear the area.
     move(y, x);
@@ -262,6 +281,89 @@ void display_message(char *s)
     attroff(COLOR_PAIR(PAIR_INFO));
 }
 
+/*
+ * Lists the save slots in place of the logo or help text, with the name,
+ * score, largest tile and date of the game saved in each. Only call after
+ * draw_grid has been called at least once.
+ */
+void display_slots(const struct slot_info slots[SAVE_SLOTS])
+{
+    // Determine starting coordinates for the list.
+    int x = board_x + 44;
+    int y = board_y + 1;
+
+    // Clear the area.
+    for (int r = 0; r < MAX_HEIGHT_LOGO_HELP; r++)
+    {
+        move(y + r, x);
+        for (int c = 0; c < MAX_WIDTH_LOGO_HELP; c++)
+        {
+            addch(' ');
+        }
+    }
+
+    // Enable colour.
+    attron(COLOR_PAIR(PAIR_INFO));
+
+    // Write a line for each slot below a heading.
+    mvaddstr(y, x, "  Name           Score  Tile Date");
+    for (int n = 0; n < SAVE_SLOTS && n + 2 < MAX_HEIGHT_LOGO_HELP; n++)
+    {
+        char line[MAX_WIDTH_LOGO_HELP + 1];
+        if (slots[n].used)
+        {
+            char date[6] = "";
+            struct tm *tm = localtime(&slots[n].saved);
+            if (tm)
+            {
+                strftime(date, sizeof date, "%m-%d", tm);
+            }
+            snprintf(line, sizeof line, "%d %-12.12s%8d%6d %s", n + 1,
+                     slots[n].name, slots[n].score, slots[n].max_tile, date);
+        }
+        else
+        {
+            snprintf(line, sizeof line, "%d (empty)", n + 1);
+        }
+        mvaddstr(y + 2 + n, x, line);
+    }
+
+    // Disable colour.
+    attroff(COLOR_PAIR(PAIR_INFO));
+}
+
+/*
+ * Displays a prompt in place of a message and lets the user type a line of up
+ * to size - 1 characters after it, which is stored in s. Only call after
+ * draw_grid has been called at least once.
+ */
+void prompt_string(const char *prompt, char *s, int size)
+{
+    // Determine starting coordinates for the prompt.
+    int x = board_x + 44;
+    int y = board_y + 18;
+
+    // Clear the area and write the prompt.
+    move(y, x);
+    for (int c = 0; c < MAX_WIDTH_LOGO_HELP; c++)
+    {
+        addch(' ');
+    }
+    attron(COLOR_PAIR(PAIR_INFO));
+    mvaddstr(y, x, prompt);
+    attroff(COLOR_PAIR(PAIR_INFO));
+
+    // Show what is typed and wait for the whole line.
+    echo();
+    curs_set(1);
+    if (getnstr(s, size - 1) == ERR)
+    {
+        s[0] = '\0';
+    }
+    curs_set(0);
+    noecho();
+}
+
 /*
  * Update the scoreboard, called whenever score changes or game ends. Only call
  * after draw_grid has been called at least once.
@@ -270,7 +372,7 @@ void update_scoreboard(bool game_over)
 {
     // Reset scoreboard, overwrite with spaces.
     for (int i = 0; i < 34; i++)
-        mvaddch(g.y + 18, g.x + 6 + i, ' ');
+        mvaddch(board_y + 18, board_x + 6 + i, ' ');
 
     // The maximum theoretical score is 3,932,100.
     // https://oeis.org/A058922
@@ -290,29 +392,39 @@ void update_scoreboard(bool game_over)
     attron(COLOR_PAIR(PAIR_INFO));
 
     // Write score string to window relative to top-left corner of board.
-    mvaddstr(g.y + 18, g.x + 40 - strlen(score_str), score_str);
+    mvaddstr(board_y + 18, board_x + 40 - strlen(score_str), score_str);
 
     // Disable colour.
     attroff(COLOR_PAIR(PAIR_INFO));
 }
 
 /*
- * (Re)draws everything to the window.
+ * (Re)draws everything to the window, first resizing it if the terminal has
+ * changed size. Only the characters which differ from those on the terminal
+ * are sent to it.
  */
 void redraw_all(void)
 {
-    // Reset ncurses.
-    endwin();
-    refresh();
-
-    // Clear screen.
-    clear();
+    // Ask the terminal for its size, rather than restarting ncurses to find
+    // out, and resize the window to match.
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 &&
+        is_term_resized(size.ws_row, size.ws_col))
+    {
+        resizeterm(size.ws_row, size.ws_col);
+    }
 
-    // Re-draw everything.
+    // Blank the window without clearing the terminal, then re-draw
+    // everything, laying it out for the window's size.
+    erase();
     draw_borders();
     draw_grid();
     draw_logo();
     draw_tiles();
-    update_scoreboard(!move_available());
+    update_scoreboard(!move_available(&g));
+
+    // Send the changes to the terminal in one go.
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
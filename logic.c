@@ -7,21 +7,393 @@
 
 #define _XOPEN_SOURCE 500
 
-#include "nc_2048.h"
+#include "logic.h"
 
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-extern struct game g;
+// Vector instructions are only used on x86, where we check at run time that
+// the processor supports them.
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Returns the value of the tile in row i and column j of a packed board, or 0
+ * if there is no tile there.
+ */
+int tile_value(board_t board, int i, int j)
+{
+    int exponent = tile_exponent(board, i, j);
+    return exponent ? 1 << exponent : 0;
+}
+
+/*
+ * Returns log_2 of the value of the tile in row i and column j of a packed
+ * board, or 0 if there is no tile there.
+ */
+int tile_exponent(board_t board, int i, int j)
+{
+    return (board >> (ROW_BITS * i + TILE_BITS * j)) & TILE_MASK;
+}
+
+/*
+ * Returns a packed row with the order of its tiles reversed.
+ */
+static uint16_t reverse_row(uint16_t row)
+{
+    return (row >> 12) | ((row >> 4) & 0x00F0) | ((row << 4) & 0x0F00) |
+           (row << 12);
+}
+
+/*
+ * Pushes the tiles of a single packed row together towards column 0, adding
+ * the value of any merged tiles to *score. Returns the resulting row.
+ */
+static uint16_t push_row(uint16_t row, int *score)
+{
+    // As for the original array implementation, we remember the last tile
+    // seen which hasn't yet been merged with another, but here we can simply
+    // collect tiles into a new row rather than tracking the number of zeros.
+    uint16_t result = 0;
+    int placed = 0;
+    int unmerged = 0;
+
+    for (int j = 0; j < DIM; j++)
+    {
+        int tile = (row >> (TILE_BITS * j)) & TILE_MASK;
+        if (tile == 0)
+        {
+            continue;
+        }
+
+        // A nibble cannot hold anything larger than 32768, so those tiles are
+        // not merged.
+        if (tile == unmerged && tile < TILE_MASK)
+        {
+            // We have found two tiles to merge.
+            result |= (tile + 1) << (TILE_BITS * placed++);
+            *score += 1 << (tile + 1);
+            unmerged = 0;
+        }
+        else
+        {
+            // The unmerged tile, if any, cannot be merged so place it and the
+            // present tile becomes the next unmerged tile.
+            if (unmerged)
+            {
+                result |= unmerged << (TILE_BITS * placed++);
+            }
+            unmerged = tile;
+        }
+    }
+
+    // Place the final unmerged tile if one exists, the rest is left empty.
+    if (unmerged)
+    {
+        result |= unmerged << (TILE_BITS * placed);
+    }
+
+    return result;
+}
+
+
+// Since a packed row is only 16 bits, there are just 65536 possible rows and
+// we can precompute the result of pushing every one of them left and right,
+// along with the score gained, in init_tables(). A move is then one table
+// lookup per row. The tables are indexed first by LEFT or RIGHT, which keeps
+// both directions in one array so move_boards() can pick a direction for each
+// board with an offset.
+static uint16_t move_table[2][1 << ROW_BITS];
+static uint32_t score_table[2][1 << ROW_BITS];
+
+// The implementations of move_boards(), defined below, and the one it uses,
+// chosen by init_tables() to suit the processor.
+static void move_boards_scalar(board_t *boards, int *scores,
+                               const uint8_t *dirs, size_t count);
+#ifdef HAVE_X86
+static void move_boards_avx2(board_t *boards, int *scores,
+                             const uint8_t *dirs, size_t count);
+#endif
+static void (*move_boards_best)(board_t *boards, int *scores,
+                                const uint8_t *dirs, size_t count);
+
+// The position of the set bit with n set bits below it in each possible byte,
+// used by select_bit() when the processor cannot do this itself.
+static uint8_t select_table[256][8];
+
+/*
+ * Generates the tables used to move tiles and place new tiles. Must be called
+ * once, before any games are started, by any program using the library.
+ */
+void init_tables(void)
+{
+    for (int row = 0; row < 1 << ROW_BITS; row++)
+    {
+        int score = 0;
+        move_table[LEFT][row] = push_row(row, &score);
+        score_table[LEFT][row] = score;
+
+        // Pushing right is the same as reversing, pushing left and reversing.
+        score = 0;
+        move_table[RIGHT][row] =
+            reverse_row(push_row(reverse_row(row), &score));
+        score_table[RIGHT][row] = score;
+    }
+
+    for (int byte = 0; byte < 256; byte++)
+    {
+        int n = 0;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (byte & (1 << bit))
+            {
+                select_table[byte][n++] = bit;
+            }
+        }
+    }
+
+    move_boards_best = move_boards_scalar;
+#ifdef HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        move_boards_best = move_boards_avx2;
+    }
+#endif
+}
+
+/*
+ * Returns log_2 of the value of the largest tile on a packed board, or 0 if
+ * the board is empty.
+ */
+int max_exponent(board_t board)
+{
+    int max = 0;
+    for (int k = 0; k < DIM * DIM; k++)
+    {
+        int tile = (board >> (TILE_BITS * k)) & TILE_MASK;
+        if (tile > max)
+        {
+            max = tile;
+        }
+    }
+    return max;
+}
+
+/*
+ * Returns the transpose of a packed board, i.e. the tile in row i and column j
+ * is swapped with the tile in row j and column i.
+ */
+board_t transpose(board_t board)
+{
+    // Transpose each 2x2 block of tiles by swapping the tiles on their
+    // anti-diagonals, which are 12 bits apart..
+    board_t a = (board & 0xF0F00F0FF0F00F0FULL) |
+                ((board & 0x0000F0F00000F0F0ULL) << 12) |
+                ((board & 0x0F0F00000F0F0000ULL) >> 12);
+
+    // ..then swap the top-right and bottom-left 2x2 blocks, which are 24 bits
+    // apart.
+    return (a & 0xFF00FF0000FF00FFULL) |
+           ((a & 0x00FF00FF00000000ULL) >> 24) |
+           ((a & 0x00000000FF00FF00ULL) << 24);
+}
+
+/*
+ * Returns the result of pushing the tiles of a packed board in the given
+ * direction, adding the value of any merged tiles to *score. The board is
+ * unchanged if no tiles can move in that direction.
+ */
+board_t move_board(board_t board, enum direction dir, int *score)
+{
+    /* All four directions work by extracting each row of the packed board as
+     * a 16-bit row and looking up the pushed row and the score gained in the
+     * tables made by init_tables(). For up and down we transpose the board
+     * before and after, so that columns become rows. This avoids walking the
+     * board column by column.
+     */
+    bool columns = dir == UP || dir == DOWN;
+    int side = dir == LEFT || dir == UP ? LEFT : RIGHT;
+    const uint16_t *table = move_table[side];
+    const uint32_t *scores = score_table[side];
+
+    if (columns)
+    {
+        board = transpose(board);
+    }
+
+    board_t after = 0;
+    for (int i = 0; i < DIM; i++)
+    {
+        uint16_t row = (board >> (ROW_BITS * i)) & ROW_MASK;
+        after |= (board_t) table[row] << (ROW_BITS * i);
+        *score += scores[row];
+    }
+
+    return columns ? transpose(after) : after;
+}
+
+/*
+ * Pushes the tiles of each packed board in a batch of count boards, boards[n]
+ * in direction dirs[n], adding the value of any merged tiles to scores[n].
+ * Gives the same results as move_board() on each board in turn, but moves
+ * several boards at once with vector instructions if the processor has them.
+ */
+void move_boards(board_t *boards, int *scores, const uint8_t *dirs,
+                 size_t count)
+{
+    move_boards_best(boards, scores, dirs, count);
+}
+
+/*
+ * move_boards() using move_board() on each board in turn, for processors
+ * without vector instructions and for the boards left over by them.
+ */
+static void move_boards_scalar(board_t *boards, int *scores,
+                               const uint8_t *dirs, size_t count)
+{
+    for (size_t n = 0; n < count; n++)
+    {
+        boards[n] = move_board(boards[n], dirs[n], &scores[n]);
+    }
+}
+
+#ifdef HAVE_X86
+/*
+ * transpose() on each of the four boards in a vector.
+ */
+__attribute__((target("avx2")))
+static __m256i transpose_avx2(__m256i boards)
+{
+    __m256i a = _mm256_or_si256(
+        _mm256_and_si256(boards, _mm256_set1_epi64x(0xF0F00F0FF0F00F0FULL)),
+        _mm256_or_si256(
+            _mm256_slli_epi64(_mm256_and_si256(boards,
+                _mm256_set1_epi64x(0x0000F0F00000F0F0ULL)), 12),
+            _mm256_srli_epi64(_mm256_and_si256(boards,
+                _mm256_set1_epi64x(0x0F0F00000F0F0000ULL)), 12)));
+    return _mm256_or_si256(
+        _mm256_and_si256(a, _mm256_set1_epi64x(0xFF00FF0000FF00FFULL)),
+        _mm256_or_si256(
+            _mm256_srli_epi64(_mm256_and_si256(a,
+                _mm256_set1_epi64x(0x00FF00FF00000000ULL)), 24),
+            _mm256_slli_epi64(_mm256_and_si256(a,
+                _mm256_set1_epi64x(0x00000000FF00FF00ULL)), 24)));
+}
+
+/*
+ * move_boards() using AVX2, moving four boards at a time.
+ */
+__attribute__((target("avx2")))
+static void move_boards_avx2(board_t *boards, int *scores,
+                             const uint8_t *dirs, size_t count)
+{
+    /* Four boards fit in a vector, which we also treat as eight 32-bit
+     * lanes each holding two rows. We transpose the boards moving up or down
+     * as move_board() does, then look up the low and high row of every lane
+     * with one gather each, adding 65536 to the rows of boards moving right
+     * or down to reach the second half of the tables. The gathers read 32
+     * bits from the 16-bit move table, so the last row pushed right would
+     * read past its end. That row is four 32768 tiles, which cannot move, so
+     * we leave it out of the gather and keep the row as it is.
+     */
+    const __m256i row_mask = _mm256_set1_epi32(ROW_MASK);
+    const __m256i last_row = _mm256_set1_epi32(2 * (1 << ROW_BITS) - 1);
+    const __m256i pairs = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const int *rows = (const int *) move_table;
+    const int *row_scores = (const int *) score_table;
+
+    size_t n = 0;
+    for (; n + 4 <= count; n += 4)
+    {
+        __m256i before =
+            _mm256_loadu_si256((const __m256i *) (boards + n));
+        uint32_t packed_dirs;
+        memcpy(&packed_dirs, dirs + n, sizeof packed_dirs);
+        __m256i dir = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed_dirs));
+
+        // UP and DOWN are the directions with bit 1 set, RIGHT and DOWN
+        // those with bit 0 set.
+        __m256i columns = _mm256_cmpeq_epi64(
+            _mm256_and_si256(dir, _mm256_set1_epi64x(2)),
+            _mm256_set1_epi64x(2));
+        __m256i side = _mm256_slli_epi64(
+            _mm256_and_si256(dir, _mm256_set1_epi64x(1)), ROW_BITS);
+        side = _mm256_or_si256(side, _mm256_slli_epi64(side, 32));
+
+        __m256i board = _mm256_blendv_epi8(before, transpose_avx2(before),
+                                           columns);
+        __m256i low = _mm256_add_epi32(_mm256_and_si256(board, row_mask),
+                                       side);
+        __m256i high = _mm256_add_epi32(_mm256_srli_epi32(board, ROW_BITS),
+                                        side);
+
+        __m256i ones = _mm256_set1_epi32(-1);
+        __m256i low_rows = _mm256_mask_i32gather_epi32(
+            ones, rows, low,
+            _mm256_xor_si256(_mm256_cmpeq_epi32(low, last_row), ones), 2);
+        __m256i high_rows = _mm256_mask_i32gather_epi32(
+            ones, rows, high,
+            _mm256_xor_si256(_mm256_cmpeq_epi32(high, last_row), ones), 2);
+        __m256i after = _mm256_or_si256(
+            _mm256_and_si256(low_rows, row_mask),
+            _mm256_slli_epi32(high_rows, ROW_BITS));
+        after = _mm256_blendv_epi8(after, transpose_avx2(after), columns);
+        _mm256_storeu_si256((__m256i *) (boards + n), after);
+
+        // Sum the scores of the four rows of each board, which end up in the
+        // even lanes, and gather those lanes together to add to the scores.
+        __m256i gained = _mm256_add_epi32(
+            _mm256_i32gather_epi32(row_scores, low, 4),
+            _mm256_i32gather_epi32(row_scores, high, 4));
+        gained = _mm256_add_epi32(gained, _mm256_srli_epi64(gained, 32));
+        gained = _mm256_permutevar8x32_epi32(gained, pairs);
+        __m128i total = _mm_add_epi32(
+            _mm_loadu_si128((const __m128i *) (scores + n)),
+            _mm256_castsi256_si128(gained));
+        _mm_storeu_si128((__m128i *) (scores + n), total);
+    }
+
+    move_boards_scalar(boards + n, scores + n, dirs + n, count - n);
+}
+#endif
+
+/*
+ * Computes the board and score a game would have after pushing its tiles in
+ * the given direction, without changing the game. Returns true iff tiles
+ * would move, in which case the results are stored in *board and *score.
+ */
+bool try_move(const struct game *g, enum direction dir, board_t *board,
+              int *score)
+{
+    // Since the board is a single integer, we can simply compare the board
+    // before and after to see if tiles moved. The results may be stored in the
+    // game itself, so only read from it before storing them.
+    int after_score = g->score;
+    board_t after = move_board(g->board, dir, &after_score);
+    if (after == g->board)
+    {
+        return false;
+    }
+    *board = after;
+    *score = after_score;
+    return true;
+}
 
 /*
  * Pushes tiles together in the left direction. Returns true if tiles have
  * moved and false if no tiles moved.
  * When pushed, tiles pass through any empty spaces and two tiles of the same
  * value will merge into one. For example,
- * the following rows in our g.tiles array would be transformed as
+ * the following rows of tiles on g->board would be transformed as
  * [0,2,0,2] ---> [4,0,0,0]
  * [4,0,4,4] ---> [8,4,0,0]
  * [2,2,2,2] ---> [4,4,0,0]
@@ -31,446 +403,1224 @@ extern struct game g;
  * time, so [2,2,2,2] becomes [4,4,0,0] not [8,0,0,0]. Only a second call to
  * left() would produce [8,0,0,0] on that row.
  */
-bool left(void)
-{
-    /* The functions left(), right(), up() and down() are all very similar and
-     * much code is repeated. The only difference is the order in which we
-     * iterate over the two dimensions of our g.tiles array.
-     * To avoid repeated code it is also possible to write a single push
-     * function for, say, the left direction. Then for the other directions
-     * copy the array into a temporary transposed and/or reversed array, call
-     * the push function on that array, then copy back that array into the
-     * original tiles array. But the saving is not dramatic and the longer
-     * approach used here is also more efficient in execution.
+bool left(struct game *g)
+{
+    // In the main game loop, new tiles are only added to the board when tiles
+    // move so we must return whether this happened, which try_move() tells us.
+    return try_move(g, LEFT, &g->board, &g->score);
+}
+
+/*
+ * Pushes tiles together in the right direction. Returns true if tiles have
+ * moved and false if no tiles moved.
+ */
+bool right(struct game *g)
+{
+    return try_move(g, RIGHT, &g->board, &g->score);
+}
+
+/*
+ * Pushes tiles together in the up direction. Returns true if tiles have moved
+ * and false if no tiles moved.
+ */
+bool up(struct game *g)
+{
+    return try_move(g, UP, &g->board, &g->score);
+}
+
+/*
+ * Pushes tiles together in the down direction. Returns true if tiles have
+ * moved and false if no tiles moved.
+ */
+bool down(struct game *g)
+{
+    return try_move(g, DOWN, &g->board, &g->score);
+}
+
+/*
+ * Seeds a random number generator. Generators given the same seed produce the
+ * same numbers.
+ */
+void rng_seed(struct rng *rng, uint64_t seed)
+{
+    // Expand the seed into the four words of state with splitmix64, as
+    // recommended by the authors of xoshiro256**, which guarantees the state
+    // is not all zero.
+    for (int n = 0; n < 4; n++)
+    {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        rng->s[n] = z ^ (z >> 31);
+    }
+}
+
+/*
+ * Rotates a 64-bit integer left by k bits.
+ */
+static uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/*
+ * Returns a random 64-bit integer, advancing the random number generator.
+ */
+uint64_t rng_next(struct rng *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/*
+ * Returns a random integer uniformly distributed over [0, bound), advancing
+ * the random number generator. bound must be positive.
+ */
+uint32_t rng_below(struct rng *rng, uint32_t bound)
+{
+    // Scaling a random 32-bit integer by bound and keeping the top 32 bits
+    // favours some results slightly, unless we reject the few low halves
+    // below 2^32 mod bound. (This is Lemire's method, which avoids a
+    // division in almost every call.)
+    uint64_t m = (rng_next(rng) >> 32) * bound;
+    if ((uint32_t) m < bound)
+    {
+        uint32_t threshold = -bound % bound;
+        while ((uint32_t) m < threshold)
+        {
+            m = (rng_next(rng) >> 32) * bound;
+        }
+    }
+    return m >> 32;
+}
+
+/*
+ * Prepares a game with an empty history, ready for reset_game(). Must be
+ * called before a game is first used, and free_game() once it is finished
+ * with.
+ */
+void init_game(struct game *g)
+{
+    memset(g, 0, sizeof *g);
+}
+
+/*
+ * Frees the memory used by the history of a game.
+ */
+void free_game(struct game *g)
+{
+    free(g->history.moves);
+    free(g->history.keyframes);
+    g->history.moves = NULL;
+    g->history.keyframes = NULL;
+    g->history.length = 0;
+    g->history.end = 0;
+    g->history.capacity = 0;
+}
+
+/*
+ * Resets the board, score and history of a game ready for a new game and
+ * places the first tile. The random number generator is left as it is.
+ */
+void reset_game(struct game *g, bool random_tiles)
+{
+    g->board = 0;
+    g->score = 0;
+    new_tile(g, random_tiles);
+
+    // Keep the space allocated for the history for the new game.
+    g->history.start = (struct keyframe) { g->board, g->score };
+    g->history.length = 0;
+    g->history.end = 0;
+}
+
+/*
+ * Returns a mask of the empty tiles on a packed board, with bit k set if the
+ * tile in row k / DIM and column k % DIM is empty.
+ */
+uint16_t empty_mask(board_t board)
+{
+    // Set the bottom bit of each nibble iff the nibble is zero..
+    board_t x = board | (board >> 2);
+    x |= x >> 1;
+    x = ~x & 0x1111111111111111ULL;
+
+#ifdef __BMI2__
+    // ..then gather those bits together.
+    return _pext_u64(x, 0x1111111111111111ULL);
+#else
+    // ..then gather those bits together, doubling the number of adjacent bits
+    // gathered at each step.
+    x = (x | (x >> 3)) & 0x0303030303030303ULL;
+    x = (x | (x >> 6)) & 0x000F000F000F000FULL;
+    x = (x | (x >> 12)) & 0x000000FF000000FFULL;
+    return x | (x >> 24);
+#endif
+}
+
+/*
+ * Returns the position of the set bit of a 16-bit mask with n set bits below
+ * it. The mask must have more than n bits set.
+ */
+static int select_bit(uint16_t mask, int n)
+{
+#ifdef __BMI2__
+    // Deposit a single bit at the position of the nth set bit of the mask.
+    return __builtin_ctz(_pdep_u32(1U << n, mask));
+#else
+    // Decide which byte of the mask holds the bit, then look up its position
+    // within that byte.
+    int low = mask & 0xFF;
+    int below = __builtin_popcount(low);
+    int high = n >= below;
+    int byte = high ? mask >> 8 : low;
+    return select_table[byte][n - high * below] + 8 * high;
+#endif
+}
+
+/*
+ * Places a new tile on the board. If random_tiles is false, places a '2' tile
+ * at the first available location on the board. If random_tiles is true,
+ * randomly selects an available location on the board and places a '2' tile
+ * there with probability 90%, or a '4' tile there with probability 10%.
+ * Returns the location used, numbered as the bits of empty_mask(), or -1 if
+ * the board is full.
+ */
+int new_tile(struct game *g, bool random_tiles)
+{
+    // Find the available locations for a new tile to be placed.
+    uint16_t empty = empty_mask(g->board);
+    if (!empty)
+    {
+        return -1;
+    }
+
+    // Pick a location to use and a tile to place there, as an exponent. Since
+    // rows are stored one after another we can treat the packed board as a
+    // flat sequence of tiles, numbered as the bits of the mask.
+    int k;
+    int new_tile;
+    if (random_tiles)
+    {
+        k = select_bit(empty, rng_below(&g->rng, __builtin_popcount(empty)));
+        new_tile = rng_below(&g->rng, 10) ? 1 : 2;
+    }
+    else
+    {
+        k = __builtin_ctz(empty);
+        new_tile = 1;
+    }
+
+    // Place the tile on the board.
+    g->board |= (board_t) new_tile << (TILE_BITS * k);
+    return k;
+}
+
+// Masks with the bottom bit of each nibble set, for every tile, for tiles with
+// a tile to their right, and for tiles with a tile below them.
+#define ALL_TILES 0x1111111111111111ULL
+#define RIGHT_NEIGHBOURS 0x0111011101110111ULL
+#define LOWER_NEIGHBOURS 0x0000111111111111ULL
+
+/*
+ * Returns a word with the bottom bit of each nibble set iff that nibble of x
+ * is zero.
+ */
+static board_t zero_nibbles(board_t x)
+{
+    x |= x >> 2;
+    x |= x >> 1;
+    return ~x & ALL_TILES;
+}
+
+/*
+ * Returns a mask of the directions in which tiles can be pushed on a packed
+ * board, with bit dir set if pushing in direction dir would move tiles.
+ */
+unsigned legal_moves(board_t board)
+{
+    /* We work on all tiles at once, using words with the bottom bit of each
+     * nibble flagging something about the corresponding tile. Tiles can be
+     * pushed left if some tile has a tile to its right and either it is empty
+     * and its neighbour is not, or the two can merge. The other directions
+     * are similar, looking at the tile below for up and down.
+     */
+    board_t empty = zero_nibbles(board);
+    board_t full = ~empty & ALL_TILES;
+
+    // Tiles which cannot merge as they are already as large as can be held.
+    board_t largest = board & (board >> 1) & (board >> 2) & (board >> 3) &
+                      ALL_TILES;
+    board_t mergeable = full & ~largest;
+
+    // Tiles equal to the tile to their right or below them.
+    board_t horizontal = zero_nibbles(board ^ (board >> TILE_BITS)) &
+                         mergeable & RIGHT_NEIGHBOURS;
+    board_t vertical = zero_nibbles(board ^ (board >> ROW_BITS)) &
+                       mergeable & LOWER_NEIGHBOURS;
+
+    board_t left = (empty & (full >> TILE_BITS) & RIGHT_NEIGHBOURS) |
+                   horizontal;
+    board_t right = (full & (empty >> TILE_BITS) & RIGHT_NEIGHBOURS) |
+                    horizontal;
+    board_t up = (empty & (full >> ROW_BITS) & LOWER_NEIGHBOURS) | vertical;
+    board_t down = (full & (empty >> ROW_BITS) & LOWER_NEIGHBOURS) | vertical;
+
+    return (left != 0) << LEFT | (right != 0) << RIGHT | (up != 0) << UP |
+           (down != 0) << DOWN;
+}
+
+/*
+ * Returns true if it is possible for the user to make a move, otherwise
+ * returns false indicating game over.
+ */
+bool move_available(const struct game *g)
+{
+    // If a move is available then either there is an empty tile or two
+    // adjacent tiles can merge, which we can check for all tiles at once in
+    // the same way as legal_moves().
+    board_t board = g->board;
+    board_t largest = board & (board >> 1) & (board >> 2) & (board >> 3) &
+                      ALL_TILES;
+    board_t horizontal = zero_nibbles(board ^ (board >> TILE_BITS)) &
+                         RIGHT_NEIGHBOURS;
+    board_t vertical = zero_nibbles(board ^ (board >> ROW_BITS)) &
+                       LOWER_NEIGHBOURS;
+    return (zero_nibbles(board) | ((horizontal | vertical) & ~largest)) != 0;
+}
+
+// Each move in a game's history is a byte with the direction moved in the
+// bottom two bits, the location of the new tile after the move in the next
+// four bits and the new tile's exponent less one in the next bit.
+#define MOVE_DIR_MASK 0x3
+#define MOVE_LOCATION_SHIFT 2
+#define MOVE_FOUR_SHIFT 6
+
+// The number of moves there is first space for in a history.
+#define HISTORY_INITIAL_CAPACITY 256
+
+/*
+ * Returns a position after making an encoded move from the history, including
+ * its new tile.
+ */
+static struct keyframe replay_move(struct keyframe position, uint8_t move)
+{
+    int location = (move >> MOVE_LOCATION_SHIFT) & TILE_MASK;
+    board_t tile = 1 + ((move >> MOVE_FOUR_SHIFT) & 1);
+    position.board = move_board(position.board, move & MOVE_DIR_MASK,
+                                &position.score);
+    position.board |= tile << (TILE_BITS * location);
+    return position;
+}
+
+/*
+ * Sets the board and score of a game to the position after the given number
+ * of moves in its history, by replaying the moves after the keyframe before
+ * that position.
+ */
+static void replay_history(struct game *g, size_t length)
+{
+    const struct history *h = &g->history;
+    size_t frame = length / KEYFRAME_INTERVAL;
+    struct keyframe position = frame ? h->keyframes[frame - 1] : h->start;
+
+    for (size_t n = frame * KEYFRAME_INTERVAL; n < length; n++)
+    {
+        position = replay_move(position, h->moves[n]);
+    }
+
+    g->board = position.board;
+    g->score = position.score;
+}
+
+/*
+ * Makes sure there is space for at least the given number of moves in a
+ * history, doubling the space for moves and keyframes as needed, which keeps
+ * the space for keyframes a whole number of intervals. Returns true iff
+ * successful.
+ */
+static bool reserve_history(struct history *h, size_t length)
+{
+    if (length <= h->capacity)
+    {
+        return true;
+    }
+
+    size_t capacity = h->capacity ? h->capacity : HISTORY_INITIAL_CAPACITY;
+    while (capacity < length)
+    {
+        capacity *= 2;
+    }
+
+    uint8_t *moves = realloc(h->moves, capacity);
+    if (!moves)
+    {
+        return false;
+    }
+    h->moves = moves;
+
+    struct keyframe *keyframes = realloc(h->keyframes,
+        capacity / KEYFRAME_INTERVAL * sizeof *keyframes);
+    if (!keyframes)
+    {
+        return false;
+    }
+    h->keyframes = keyframes;
+    h->capacity = capacity;
+    return true;
+}
+
+/*
+ * Adds a move to the history of a game, the move being in direction dir and
+ * followed by a new tile at the given location, and the game's board and
+ * score being those after the new tile. Returns true iff successful.
+ */
+bool push_undo(struct game *g, enum direction dir, int location)
+{
+    struct history *h = &g->history;
+    if (!reserve_history(h, h->length + 1))
+    {
+        return false;
+    }
+
+    int four = tile_exponent(g->board, location / DIM, location % DIM) - 1;
+    h->moves[h->length++] = dir | location << MOVE_LOCATION_SHIFT |
+                            four << MOVE_FOUR_SHIFT;
+    h->end = h->length;
+
+    if (h->length % KEYFRAME_INTERVAL == 0)
+    {
+        h->keyframes[h->length / KEYFRAME_INTERVAL - 1] =
+            (struct keyframe) { g->board, g->score };
+    }
+    return true;
+}
+
+/*
+ * If no moves are left in the history, return false. Otherwise, undo the last
+ * move in the history, reverting the tiles and score to the values they had
+ * before it, and return true. The move is kept so it can be redone.
+ */
+bool pop_undo(struct game *g)
+{
+    if (g->history.length == 0)
+    {
+        return false;
+    }
+
+    g->history.length--;
+    replay_history(g, g->history.length);
+    return true;
+}
+
+/*
+ * If no moves have been undone since the last move was made, return false.
+ * Otherwise, make the last move undone again, including its new tile, and
+ * return true.
+ */
+bool redo(struct game *g)
+{
+    struct history *h = &g->history;
+    if (h->length == h->end)
+    {
+        return false;
+    }
+
+    // The move follows on from the current position, so there is nothing to
+    // replay besides the move itself. Keyframes after the current position
+    // are still those of the moves being redone.
+    struct keyframe position = { g->board, g->score };
+    position = replay_move(position, h->moves[h->length++]);
+    g->board = position.board;
+    g->score = position.score;
+    return true;
+}
+
+// Saved games start with a header of SAVE_HEADER_SIZE bytes holding:
+//     0  the magic number SAVE_MAGIC
+//     4  the version of the format, SAVE_VERSION (16 bits)
+//     6  flags, SAVE_HISTORY if the history follows the header (16 bits)
+//     8  the packed board (64 bits)
+//    16  the score (32 bits)
+//    20  the state of the random number generator (4 x 64 bits)
+// With SAVE_HISTORY set, a history of SAVE_HISTORY_SIZE bytes plus one byte
+// per move follows, holding:
+//     0  the packed board at the start (64 bits)
+//     8  the score at the start (32 bits)
+//    12  the number of moves to the current position (32 bits)
+//    16  the number of moves including those undone (32 bits)
+//    20  the moves, encoded as above
+// Finally the CRC-32 of everything before it (32 bits). Every number is
+// unsigned and little-endian, so files load the same on any machine.
+#define SAVE_MAGIC "NC2K"
+#define SAVE_VERSION 1
+#define SAVE_HISTORY 0x1
+#define SAVE_HEADER_SIZE 52
+#define SAVE_HISTORY_SIZE 20
+#define SAVE_CHECKSUM_SIZE 4
+
+// Saves larger than this are rejected without reading them.
+#define SAVE_MAX_SIZE (1 << 24)
+
+// The index of save slots starts with the magic number INDEX_MAGIC, the
+// version as in saves (16 bits) and the number of slots (16 bits), followed
+// by INDEX_ENTRY_SIZE bytes for each slot holding:
+//     0  1 if the slot holds a save, otherwise 0 (8 bits)
+//     1  the name, padded with zeros (SLOT_NAME_LENGTH bytes)
+//    25  the score (32 bits)
+//    29  the largest tile (32 bits)
+//    33  the time saved, in seconds since the epoch (64 bits, signed)
+// where the offsets after the name assume SLOT_NAME_LENGTH is 24, and ends
+// with the CRC-32 as in saves.
+#define INDEX_MAGIC "NC2I"
+#define INDEX_HEADER_SIZE 8
+#define INDEX_ENTRY_SIZE (SLOT_NAME_LENGTH + 17)
+
+// Saves are first written to the save's name with TEMP_SUFFIX appended, and
+// the previous save is kept with BACKUP_SUFFIX appended.
+#define TEMP_SUFFIX ".tmp"
+#define BACKUP_SUFFIX ".bak"
+
+/*
+ * Stores the bottom bytes of a number at p, least significant byte first.
+ */
+static void put_le(uint8_t *p, uint64_t value, int bytes)
+{
+    for (int n = 0; n < bytes; n++)
+    {
+        p[n] = value >> (8 * n);
+    }
+}
+
+/*
+ * Returns the number stored in bytes at p, least significant byte first.
+ */
+static uint64_t get_le(const uint8_t *p, int bytes)
+{
+    uint64_t value = 0;
+    for (int n = 0; n < bytes; n++)
+    {
+        value |= (uint64_t) p[n] << (8 * n);
+    }
+    return value;
+}
+
+/*
+ * Returns the CRC-32 of size bytes at p, as used by zip and PNG.
+ */
+static uint32_t crc32(const uint8_t *p, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t n = 0; n < size; n++)
+    {
+        crc ^= p[n];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/*
+ * Writes size bytes of data to the file at path so that, even if the program
+ * or machine crashes part way through, the file holds either the data or its
+ * previous contents. The previous contents are kept as a backup, at path with
+ * BACKUP_SUFFIX appended. Returns true iff successful.
+ */
+static bool write_save(const char *path, const uint8_t *data, size_t size)
+{
+    /* The data is written to a temporary file and flushed to disk, then
+     * renamed over the save, which replaces it in a single step. The backup
+     * is made beforehand as a second link to the old save, so there is never
+     * a moment without a save at path. Finally the directory is flushed so
+     * the rename itself survives a crash.
      */
+    char temp[FILENAME_MAX];
+    char backup[FILENAME_MAX];
+    if (snprintf(temp, sizeof temp, "%s%s", path, TEMP_SUFFIX) >=
+            (int) sizeof temp ||
+        snprintf(backup, sizeof backup, "%s%s", path, BACKUP_SUFFIX) >=
+            (int) sizeof backup)
+    {
+        return false;
+    }
+
+    FILE *fp = fopen(temp, "wb");
+    if (!fp)
+    {
+        return false;
+    }
+    bool ok = fwrite(data, size, 1, fp) == 1 && fflush(fp) == 0 &&
+              fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok)
+    {
+        remove(temp);
+        return false;
+    }
+
+    // The backup is only a convenience, so carry on without it if it cannot
+    // be made, e.g. if there is no old save.
+    unlink(backup);
+    link(path, backup);
+
+    if (rename(temp, path) != 0)
+    {
+        remove(temp);
+        return false;
+    }
 
-    // In the main game loop, new tiles are only added to the board when tiles
-    // move so we must track if this happens and return the result.
-    bool new_tile_needed = false;
+    // Flush the directory holding the save.
+    char dir[FILENAME_MAX];
+    snprintf(dir, sizeof dir, "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash)
+    {
+        slash[1] = '\0';
+    }
+    else
+    {
+        strcpy(dir, ".");
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    return true;
+}
 
-    // We need a single loop over the tiles array and can change the values
-    // in place.
-    for (int i = 0; i < DIM; i++)
+/*
+ * Encodes the current state of the game, and its history if history is true,
+ * in the save format, leaving space for prefix bytes before it. Returns the
+ * encoding, to be freed by the caller, storing its size excluding the prefix in
+ * *size, or NULL if out of memory.
+ */
+static uint8_t *encode_game(const struct game *g, bool history, size_t prefix,
+                            size_t *size)
+{
+    const struct history *h = &g->history;
+    *size = SAVE_HEADER_SIZE + SAVE_CHECKSUM_SIZE;
+    if (history)
+    {
+        *size += SAVE_HISTORY_SIZE + h->end;
+    }
+    uint8_t *buffer = malloc(prefix + *size);
+    if (!buffer)
     {
-        // For each row of tiles we track the number of zeros seen, and we
-        // remember the value of the last non-zero tile seen which hasn't yet
-        // been merged with another.
-        int zeros = 0;
-        int unmerged = 0;
+        return NULL;
+    }
+    uint8_t *data = buffer + prefix;
 
-        for (int j = 0; j < DIM; j++)
-        {
-            if (g.tiles[i][j] == 0)
-            {
-                zeros++;
-            }
-            else if (g.tiles[i][j] == unmerged)
-            {
-                // We have found two tiles to merge.
-                // Place the resulting tile in the leftmost position.
-                g.tiles[i][j-zeros-1] = unmerged * 2;
-                g.score += unmerged * 2;
-                new_tile_needed = true;
-                zeros++;
-                unmerged = 0;
-            }
-            else if (unmerged)
-            {
-                // The unmerged tile cannot be merged.
-                if (zeros)
-                {
-                    new_tile_needed = true;
-                }
-                // It goes back into the array and the present tile becomes
-                // the next unmerged tile.
-                g.tiles[i][j-zeros-1] = unmerged;
-                unmerged = g.tiles[i][j];
-            }
-            else
-            {
-                // The last possibility is that there was no unmerged tile, so
-                // just select the present tile to become the unmerged tile.
-                unmerged = g.tiles[i][j];
-            }
-        }
+    memcpy(data, SAVE_MAGIC, 4);
+    put_le(data + 4, SAVE_VERSION, 2);
+    put_le(data + 6, history ? SAVE_HISTORY : 0, 2);
+    put_le(data + 8, g->board, 8);
+    put_le(data + 16, (uint32_t) g->score, 4);
+    for (int n = 0; n < 4; n++)
+    {
+        put_le(data + 20 + 8 * n, g->rng.s[n], 8);
+    }
 
-        // Now we are finished merging tiles and need to fill out any possible
-        // remaining spaces in the row. Firstly, with the current unmerged tile
-        // if one exists..
-        if (unmerged)
+    uint8_t *p = data + SAVE_HEADER_SIZE;
+    if (history)
+    {
+        put_le(p, h->start.board, 8);
+        put_le(p + 8, (uint32_t) h->start.score, 4);
+        put_le(p + 12, h->length, 4);
+        put_le(p + 16, h->end, 4);
+        // A history with no moves may have no space allocated for them.
+        if (h->end)
         {
-            if (g.tiles[i][DIM-zeros-1] != unmerged)
-            {
-                new_tile_needed = true;
-                g.tiles[i][DIM-zeros-1] = unmerged;
-            }
+            memcpy(p + SAVE_HISTORY_SIZE, h->moves, h->end);
         }
+        p += SAVE_HISTORY_SIZE + h->end;
+    }
+    put_le(p, crc32(data, p - data), 4);
+    return buffer;
+}
 
-        // ..secondly with empty tiles.
-        while (zeros)
-        {
-            g.tiles[i][DIM-zeros] = 0;
-            zeros--;
-        }
+/*
+ * Saves the current state of the game, and its history if history is true, to
+ * the file at path and if successful returns true, otherwise returns false.
+ */
+static bool write_game(const struct game *g, const char *path, bool history)
+{
+    size_t size;
+    uint8_t *data = encode_game(g, history, 0, &size);
+    if (!data)
+    {
+        return false;
     }
 
-    return new_tile_needed;
+    bool ok = write_save(path, data, size);
+    free(data);
+    return ok;
 }
 
 /*
- * Pushes tiles together in the right direction. Returns true if tiles have
- * moved and false if no tiles moved.
+ * Replaces the history with one read from a saved game, rebuilding its
+ * keyframes by replaying every move, which must end at the given board and
+ * score. Returns false, leaving the history as it was, if the moves are not
+ * possible or do not end there.
  */
-bool right(void)
+static bool load_history(struct history *history, const uint8_t *p,
+                         board_t board, int score)
 {
-    bool new_tile_needed = false;
-    for (int i = 0; i < DIM; i++)
+    struct history h = { 0 };
+    h.start.board = get_le(p, 8);
+    h.start.score = (int32_t) get_le(p + 8, 4);
+    h.length = get_le(p + 12, 4);
+    h.end = get_le(p + 16, 4);
+    if (h.length > h.end || !reserve_history(&h, h.end))
     {
-        int zeros = 0;
-        int unmerged = 0;
-        // The only difference with the left() function is that we iterate
-        // in reverse over each row.
-        for (int j = DIM - 1; j >= 0; j--)
-        {
-            if (g.tiles[i][j] == 0)
-            {
-                zeros++;
-            }
-            else if (g.tiles[i][j] == unmerged)
-            {
-                g.tiles[i][j+zeros+1] = unmerged * 2;
-                g.score += unmerged * 2;
-                new_tile_needed = true;
-                zeros++;
-                unmerged = 0;
-            }
-            else if (unmerged)
-            {
-                if (zeros)
-                {
-                    new_tile_needed = true;
-                }
-                g.tiles[i][j+zeros+1] = unmerged;
-                unmerged = g.tiles[i][j];
-            }
-            else
-            {
-                unmerged = g.tiles[i][j];
-            }
-        }
-        if (unmerged)
+        free(h.moves);
+        free(h.keyframes);
+        return false;
+    }
+    if (h.end)
+    {
+        memcpy(h.moves, p + SAVE_HISTORY_SIZE, h.end);
+    }
+
+    // Each move must move tiles and its new tile must be on an empty tile.
+    bool ok = true;
+    struct keyframe position = h.start;
+    for (size_t n = 0; n < h.end && ok; n++)
+    {
+        uint8_t move = h.moves[n];
+        int gained = 0;
+        board_t moved = move_board(position.board, move & MOVE_DIR_MASK,
+                                   &gained);
+        int location = (move >> MOVE_LOCATION_SHIFT) & TILE_MASK;
+        ok = moved != position.board && move >> (MOVE_FOUR_SHIFT + 1) == 0 &&
+             (empty_mask(moved) >> location & 1);
+
+        position = replay_move(position, move);
+        if ((n + 1) % KEYFRAME_INTERVAL == 0)
         {
-            if (g.tiles[i][zeros] != unmerged)
-            {
-                new_tile_needed = true;
-                g.tiles[i][zeros] = unmerged;
-            }
+            h.keyframes[(n + 1) / KEYFRAME_INTERVAL - 1] = position;
         }
-        while (zeros)
+        if (n + 1 == h.length)
         {
-            g.tiles[i][zeros-1] = 0;
-            zeros--;
+            ok = ok && position.board == board && position.score == score;
         }
     }
-    return new_tile_needed;
+    if (h.length == 0)
+    {
+        ok = ok && h.start.board == board && h.start.score == score;
+    }
+
+    if (!ok)
+    {
+        free(h.moves);
+        free(h.keyframes);
+        return false;
+    }
+
+    free(history->moves);
+    free(history->keyframes);
+    *history = h;
+    return true;
 }
 
 /*
- * Pushes tiles together in the up direction. Returns true if tiles have moved
- * and false if no tiles moved.
+ * Returns true iff size bytes of data, at least enough for a magic number,
+ * version and checksum, start with the given magic number and the current
+ * version and end with a matching checksum.
  */
-bool up(void)
+static bool check_save(const uint8_t *data, long size, const char *magic)
 {
-    bool new_tile_needed = false;
-    // The only difference with the left() function is that we iterate over
-    // columns first and then over rows.
-    for (int j = 0; j < DIM; j++)
+    return size >= 6 + SAVE_CHECKSUM_SIZE && memcmp(data, magic, 4) == 0 &&
+           get_le(data + 4, 2) == SAVE_VERSION &&
+           get_le(data + size - SAVE_CHECKSUM_SIZE, 4) ==
+               crc32(data, size - SAVE_CHECKSUM_SIZE);
+}
+
+/*
+ * Reads the whole of the file at path, checking it is at least min_size bytes
+ * long and at most SAVE_MAX_SIZE bytes. Returns the contents, to be freed by
+ * the caller, storing their size in *size, or NULL if the file cannot be read
+ * or has the wrong size.
+ */
+static uint8_t *read_file(const char *path, long min_size, long *size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
     {
-        int zeros = 0;
-        int unmerged = 0;
-        for (int i = 0; i < DIM; i++)
-        {
-            if (g.tiles[i][j] == 0)
-            {
-                zeros++;
-            }
-            else if (g.tiles[i][j] == unmerged)
-            {
-                g.tiles[i-zeros-1][j] = unmerged * 2;
-                g.score += unmerged * 2;
-                new_tile_needed = true;
-                zeros++;
-                unmerged = 0;
-            }
-            else if (unmerged)
-            {
-                if (zeros)
-                {
-                    new_tile_needed = true;
-                }
-                g.tiles[i-zeros-1][j] = unmerged;
-                unmerged = g.tiles[i][j];
-            }
-            else
-            {
-                unmerged = g.tiles[i][j];
-            }
-        }
-        if (unmerged)
-        {
-            if (g.tiles[DIM-zeros-1][j] != unmerged)
-            {
-                new_tile_needed = true;
-                g.tiles[DIM-zeros-1][j] = unmerged;
-            }
-        }
-        while (zeros)
-        {
-            g.tiles[DIM-zeros][j] = 0;
-            zeros--;
-        }
+        return NULL;
+    }
+
+    // Check the file's size before reading it.
+    *size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0)
+    {
+        *size = ftell(fp);
+    }
+    if (*size < min_size || *size > SAVE_MAX_SIZE ||
+        fseek(fp, 0, SEEK_SET) != 0)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    uint8_t *data = malloc(*size);
+    bool read = data && fread(data, *size, 1, fp) == 1;
+    fclose(fp);
+    if (!read)
+    {
+        free(data);
+        return NULL;
     }
-    return new_tile_needed;
+    return data;
 }
 
 /*
- * Pushes tiles together in the down direction. Returns true if tiles have
- * moved and false if no tiles moved.
+ * Reads the whole of a file at path written by write_save(), checking it is
+ * at least min_size bytes long, starts with the given magic number and the
+ * current version and has a matching checksum. Returns the contents, to be
+ * freed by the caller, storing their size in *size, or NULL if the file
+ * cannot be read or fails the checks.
  */
-bool down(void)
+static uint8_t *read_save(const char *path, const char *magic,
+                          long min_size, long *size)
 {
-    bool new_tile_needed = false;
-    // The only differences with the left() function is that we iterate over
-    // columns first and then over rows and when we iterate over rows we do so
-    // in reverse.
-    for (int j = 0; j < DIM; j++)
+    uint8_t *data = read_file(path, min_size, size);
+    if (data && !check_save(data, *size, magic))
     {
-        int zeros = 0;
-        int unmerged = 0;
-        for (int i = DIM - 1; i >= 0; i--)
-        {
-            if (g.tiles[i][j] == 0)
-            {
-                zeros++;
-            }
-            else if (g.tiles[i][j] == unmerged)
-            {
-                g.tiles[i+zeros+1][j] = unmerged * 2;
-                g.score += unmerged * 2;
-                new_tile_needed = true;
-                zeros++;
-                unmerged = 0;
-            }
-            else if (unmerged)
-            {
-                if (zeros)
-                {
-                    new_tile_needed = true;
-                }
-                g.tiles[i+zeros+1][j] = unmerged;
-                unmerged = g.tiles[i][j];
-            }
-            else
-            {
-                unmerged = g.tiles[i][j];
-            }
-        }
-        if (unmerged)
-        {
-            if (g.tiles[zeros][j] != unmerged)
-            {
-                new_tile_needed = true;
-                g.tiles[zeros][j] = unmerged;
-            }
-        }
-        while (zeros)
-        {
-            g.tiles[zeros-1][j] = 0;
-            zeros--;
-        }
+        free(data);
+        return NULL;
     }
-    return new_tile_needed;
+    return data;
 }
 
 /*
- * Places a new tile on the board. If random_tiles is false, places a '2' tile
- * at the first available location on the board. If random_tiles is true,
- * randomly selects an available location on the board and places a '2' tile
- * there with probability 90%, or a '4' tile there with probability 10%.
+ * Decodes a game from size bytes of data in the save format, whose magic
+ * number, version and checksum have been checked with check_save(). Returns
+ * true iff successful, otherwise leaves the game as it was.
  */
-void new_tile(bool random_tiles)
+static bool decode_game(struct game *g, const uint8_t *data, long size)
 {
-    // Count the number of available locations for a new tile to be placed.
-    int zeros_count = 0;
-    for (int i = 0; i < DIM; i++)
+    // The sizes given in the file must account for every byte.
+    unsigned flags = get_le(data + 6, 2);
+    uint64_t expected = SAVE_HEADER_SIZE + SAVE_CHECKSUM_SIZE;
+    if (flags & SAVE_HISTORY)
     {
-        for (int j = 0; j < DIM; j++)
+        expected += SAVE_HISTORY_SIZE;
+        if ((uint64_t) size >= expected)
         {
-            if (g.tiles[i][j] == 0)
-            {
-                zeros_count++;
-            }
+            expected += get_le(data + SAVE_HEADER_SIZE + 16, 4);
         }
     }
+    if ((flags & ~SAVE_HISTORY) || (uint64_t) size != expected)
+    {
+        return false;
+    }
 
-    // Pick a location to use and a tile to place there.
-    int new_placement;
-    int new_tile;
-    if (random_tiles)
+    board_t board = get_le(data + 8, 8);
+    int score = (int32_t) get_le(data + 16, 4);
+    struct rng rng;
+    uint64_t any_set = 0;
+    for (int n = 0; n < 4; n++)
     {
-        new_placement = (int) (drand48() * zeros_count);
-        new_tile = drand48() < 0.9 ? 2 : 4;
+        rng.s[n] = get_le(data + 20 + 8 * n, 8);
+        any_set |= rng.s[n];
     }
-    else
+
+    // xoshiro256** never leaves the all-zero state, where every number is
+    // zero and rng_below() would never return, so rng_seed() never makes it.
+    if (!any_set)
     {
-        new_placement = 0;
-        new_tile = 2;
+        return false;
     }
 
-    // Place the tile on the board.
-    zeros_count = 0;
-    for (int i = 0; i < DIM; i++)
+    // Without a history, the history starts from the loaded position.
+    bool ok = true;
+    if (flags & SAVE_HISTORY)
     {
-        for (int j = 0; j < DIM; j++)
-        {
-            if (g.tiles[i][j] == 0)
-            {
-                if (zeros_count == new_placement)
-                {
-                    g.tiles[i][j] = new_tile;
-                    return;
-                }
-                else
-                {
-                    zeros_count++;
-                }
-            }
-        }
+        ok = load_history(&g->history, data + SAVE_HEADER_SIZE, board, score);
+    }
+    else
+    {
+        g->history.start = (struct keyframe) { board, score };
+        g->history.length = 0;
+        g->history.end = 0;
+    }
+    if (!ok)
+    {
+        return false;
     }
+
+    g->board = board;
+    g->score = score;
+    g->rng = rng;
+    return true;
 }
 
 /*
- * Returns true if it is possible for the user to make a move, otherwise
- * returns false indicating game over.
+ * Loads a saved game from the file at path and if successful returns true,
+ * otherwise returns false, leaving the game as it was.
  */
-bool move_available(void)
+static bool load_save(struct game *g, const char *path)
 {
-    // If a move is available then either there is a zero tile or two adjacent
-    // tiles have the same value.
-    for (int i = 0; i < DIM; i++)
+    long size;
+    uint8_t *data = read_save(path, SAVE_MAGIC,
+                              SAVE_HEADER_SIZE + SAVE_CHECKSUM_SIZE, &size);
+    if (!data)
     {
-        for (int j = 0; j < DIM; j++)
-        {
-            if (g.tiles[i][j] == 0)
-            {
-                return true;
-            }
-            if (i < DIM - 1 && g.tiles[i][j] == g.tiles[i+1][j])
-            {
-                return true;
-            }
-            if (j < DIM - 1 && g.tiles[i][j] == g.tiles[i][j+1])
-            {
-                return true;
-            }
-        }
+        return false;
     }
 
-    return false;
+    bool ok = decode_game(g, data, size);
+    free(data);
+    return ok;
 }
 
 /*
- * Push the current tiles and score to the undo stack, cyclically overwriting
- * the oldest values if the stack capacity has been reached.
+ * Reads the index of save slots into slots, marking every slot unused if
+ * there is no index yet. If the index is corrupt, the backup of the previous
+ * index is read instead if possible. Returns true iff successful.
  */
-void push_undo(void)
+bool read_slots(struct slot_info slots[SAVE_SLOTS])
 {
-    // Cyclically increment the stack top.
-    g.undo.top = (g.undo.top + 1) % UNDO_CAPACITY;
-    // If not yet at capacity, increment the stack size.
-    if (g.undo.size < UNDO_CAPACITY)
+    memset(slots, 0, SAVE_SLOTS * sizeof *slots);
+
+    long size;
+    long min_size = INDEX_HEADER_SIZE + SAVE_CHECKSUM_SIZE;
+    uint8_t *data = read_save(INDEXFILE, INDEX_MAGIC, min_size, &size);
+    if (!data)
+    {
+        data = read_save(INDEXFILE BACKUP_SUFFIX, INDEX_MAGIC, min_size,
+                         &size);
+    }
+    if (!data)
+    {
+        // With no index at all, nothing has been saved yet.
+        return access(INDEXFILE, F_OK) != 0 &&
+               access(INDEXFILE BACKUP_SUFFIX, F_OK) != 0;
+    }
+
+    // Files written with a different number of slots are fine, as long as
+    // their size matches, and any slots beyond ours are ignored.
+    int count = get_le(data + 6, 2);
+    if (size != min_size + (long) count * INDEX_ENTRY_SIZE)
+    {
+        free(data);
+        return false;
+    }
+
+    for (int n = 0; n < count && n < SAVE_SLOTS; n++)
     {
-        g.undo.size++;
+        const uint8_t *p = data + INDEX_HEADER_SIZE + n * INDEX_ENTRY_SIZE;
+        slots[n].used = p[0];
+        memcpy(slots[n].name, p + 1, SLOT_NAME_LENGTH);
+        slots[n].name[SLOT_NAME_LENGTH] = '\0';
+        slots[n].score = (int32_t) get_le(p + 1 + SLOT_NAME_LENGTH, 4);
+        slots[n].max_tile = get_le(p + 5 + SLOT_NAME_LENGTH, 4);
+        slots[n].saved = (time_t) (int64_t) get_le(p + 9 + SLOT_NAME_LENGTH, 8);
     }
+    free(data);
+    return true;
+}
 
-    // Copy the relevant values.
-    memcpy(g.undo.tiles[g.undo.top], g.tiles, sizeof g.tiles);
-    g.undo.score[g.undo.top] = g.score;
+/*
+ * Writes the index of save slots, in the same way as saves. Returns true iff
+ * successful.
+ */
+static bool write_slots(const struct slot_info slots[SAVE_SLOTS])
+{
+    uint8_t data[INDEX_HEADER_SIZE + SAVE_SLOTS * INDEX_ENTRY_SIZE +
+                 SAVE_CHECKSUM_SIZE] = { 0 };
+    memcpy(data, INDEX_MAGIC, 4);
+    put_le(data + 4, SAVE_VERSION, 2);
+    put_le(data + 6, SAVE_SLOTS, 2);
+    for (int n = 0; n < SAVE_SLOTS; n++)
+    {
+        uint8_t *p = data + INDEX_HEADER_SIZE + n * INDEX_ENTRY_SIZE;
+        p[0] = slots[n].used;
+        strncpy((char *) p + 1, slots[n].name, SLOT_NAME_LENGTH);
+        put_le(p + 1 + SLOT_NAME_LENGTH, (uint32_t) slots[n].score, 4);
+        put_le(p + 5 + SLOT_NAME_LENGTH, slots[n].max_tile, 4);
+        put_le(p + 9 + SLOT_NAME_LENGTH, (int64_t) slots[n].saved, 8);
+    }
+    size_t size = sizeof data - SAVE_CHECKSUM_SIZE;
+    put_le(data + size, crc32(data, size), 4);
+    return write_save(INDEXFILE, data, sizeof data);
 }
 
 /*
- * If no undos are available, return false. Otherwise, pop from the undo stack
- * reverting the tiles and score to the values they had prior to the last
- * (non-trivial) move and return true.
+ * Saves the current state of the game, and its history if history is true, in
+ * the numbered slot, from 1 to SAVE_SLOTS, under the given name, and records
+ * it in the index of slots. If successful returns true, otherwise returns
+ * false. The save is replaced in a single step, so a crash leaves either the
+ * old or the new save, and the old save is kept as a backup.
  */
-bool pop_undo(void)
+bool save_game(const struct game *g, int slot, const char *name,
+               bool history)
 {
-    // Check there are still valid values to restore.
-    if (g.undo.size <= 1)
+    char path[FILENAME_MAX];
+    if (slot < 1 || slot > SAVE_SLOTS ||
+        snprintf(path, sizeof path, SAVEFILE, slot) >= (int) sizeof path ||
+        !write_game(g, path, history))
     {
         return false;
     }
 
-    // Locate the index prior to the current top.
-    int index = g.undo.top ? g.undo.top - 1 : UNDO_CAPACITY - 1;
+    // An unreadable index is replaced, losing only the other slots' details.
+    struct slot_info slots[SAVE_SLOTS];
+    read_slots(slots);
+    struct slot_info *info = &slots[slot - 1];
+    info->used = true;
+    snprintf(info->name, sizeof info->name, "%s", name);
+    info->score = g->score;
+    info->max_tile = 1 << max_exponent(g->board);
+    info->saved = time(NULL);
+    return write_slots(slots);
+}
+
+/*
+ * Loads the game saved in the numbered slot, from 1 to SAVE_SLOTS, and if
+ * successful returns true, otherwise returns false, leaving the game as it
+ * was. Files which are corrupt or from a later version of the format are
+ * rejected, in which case the backup of the previous save is loaded instead
+ * if possible.
+ */
+bool load_game(struct game *g, int slot)
+{
+    char path[FILENAME_MAX];
+    char backup[FILENAME_MAX];
+    if (slot < 1 || slot > SAVE_SLOTS ||
+        snprintf(path, sizeof path, SAVEFILE, slot) >= (int) sizeof path ||
+        snprintf(backup, sizeof backup, SAVEFILE BACKUP_SUFFIX, slot) >=
+            (int) sizeof backup)
+    {
+        return false;
+    }
+    return load_save(g, path) || load_save(g, backup);
+}
 
-    // Copy the relevant values.
-    memcpy(g.tiles, g.undo.tiles[index], sizeof g.tiles);
-    g.score = g.undo.score[index];
+// The journal starts with a header of JOURNAL_HEADER_SIZE bytes holding:
+//     0  the magic number JOURNAL_MAGIC
+//     4  the version of the format, as in saves (16 bits)
+//     6  flags, JOURNAL_RANDOM if new tiles were being placed randomly when
+//        the journal was started (16 bits)
+//     8  the size of the snapshot (32 bits)
+// followed by the snapshot of the game, a whole save with its history, then
+// one byte per record. A record below JOURNAL_EVENT is a move, encoded as in
+// the history, and otherwise it is JOURNAL_EVENT plus an enum journal_event.
+// Since every record is a single byte, a journal cut short by a crash never
+// ends with part of a record.
+#define JOURNAL_MAGIC "NC2J"
+#define JOURNAL_RANDOM 0x1
+#define JOURNAL_HEADER_SIZE 12
+#define JOURNAL_EVENT 0x80
 
-    // Cyclically decrement the stack top.
-    g.undo.top = (g.undo.top + UNDO_CAPACITY - 1) % UNDO_CAPACITY;
-    // Decrement the stack size.
-    g.undo.size--;
+/*
+ * Appends a record to a journal. Returns true iff successful.
+ */
+static bool append_record(struct journal *j, uint8_t record)
+{
+    if (!j->fp)
+    {
+        return false;
+    }
 
+    // Flushing hands the record to the kernel, so it survives the process
+    // being killed, which costs a system call but no disk access. Only every
+    // JOURNAL_SYNC_INTERVAL records is the journal flushed to disk, which
+    // bounds what a power failure can lose.
+    if (fputc(record, j->fp) == EOF || fflush(j->fp) != 0)
+    {
+        return false;
+    }
+    if (++j->unsynced >= JOURNAL_SYNC_INTERVAL)
+    {
+        j->unsynced = 0;
+        return fsync(fileno(j->fp)) == 0;
+    }
     return true;
 }
 
 /*
- * Saves the current state of the game to the filename SAVEFILE defined in
- * nc_2048.h and if successful returns true, otherwise returns false.
+ * Starts a new journal in the file JOURNALFILE defined in logic.h, replacing
+ * any previous one, with a snapshot of the game including its history and
+ * whether new tiles are placed randomly. The journal j must be zeroed before
+ * it is first started. Returns true iff successful.
  */
-bool save_game(void)
+bool start_journal(struct journal *j, const struct game *g, bool random_tiles)
 {
-    FILE *fp = fopen(SAVEFILE, "wb");
-    if (!fp)
+    close_journal(j);
+
+    size_t size;
+    uint8_t *data = encode_game(g, true, JOURNAL_HEADER_SIZE, &size);
+    if (!data)
     {
         return false;
     }
+    memcpy(data, JOURNAL_MAGIC, 4);
+    put_le(data + 4, SAVE_VERSION, 2);
+    put_le(data + 6, random_tiles ? JOURNAL_RANDOM : 0, 2);
+    put_le(data + 8, size, 4);
 
-    if (fwrite(&g, sizeof g, 1, fp) != 1)
+    // The snapshot replaces the old journal in a single step, then records
+    // are appended to it.
+    bool ok = write_save(JOURNALFILE, data, JOURNAL_HEADER_SIZE + size);
+    free(data);
+    if (ok)
     {
-        fclose(fp);
-        return false;
+        j->fp = fopen(JOURNALFILE, "ab");
+        j->unsynced = 0;
     }
+    return ok && j->fp;
+}
 
-    fclose(fp);
-    return true;
+/*
+ * Appends the last move in the history of a game to a journal. Returns true
+ * iff successful.
+ */
+bool journal_move(struct journal *j, const struct game *g)
+{
+    const struct history *h = &g->history;
+    return h->length > 0 && append_record(j, h->moves[h->length - 1]);
 }
 
 /*
- * Loads a previously saved game from the filename SAVEFILE defined in
- * nc_2048.h and if successful returns true, otherwise returns false.
+ * Appends an event other than a move to a journal. Returns true iff
+ * successful.
  */
-bool load_game(void)
+bool journal_event(struct journal *j, enum journal_event event)
 {
-    FILE *fp = fopen(SAVEFILE, "rb");
-    if (!fp)
+    return append_record(j, JOURNAL_EVENT + event);
+}
+
+/*
+ * Flushes a journal to disk and closes it, if it is open. Returns true iff
+ * successful.
+ */
+bool close_journal(struct journal *j)
+{
+    if (!j->fp)
+    {
+        return true;
+    }
+    bool ok = fflush(j->fp) == 0 && fsync(fileno(j->fp)) == 0;
+    ok = fclose(j->fp) == 0 && ok;
+    j->fp = NULL;
+    return ok;
+}
+
+/*
+ * Replays a record from a journal on a game in which new tiles are placed
+ * randomly if *random_tiles is true. A move is made again, with a new tile
+ * from the game's random number generator, and must give the recorded new
+ * tile. Returns true iff successful, otherwise leaves the game as it was.
+ */
+static bool replay_record(struct game *g, uint8_t record, bool *random_tiles)
+{
+    switch (record)
+    {
+        case JOURNAL_EVENT + JOURNAL_UNDO:
+            return pop_undo(g);
+
+        case JOURNAL_EVENT + JOURNAL_REDO:
+            return redo(g);
+
+        case JOURNAL_EVENT + JOURNAL_RANDOM_TILES:
+            *random_tiles = true;
+            return true;
+
+        case JOURNAL_EVENT + JOURNAL_DETERMINISTIC_TILES:
+            *random_tiles = false;
+            return true;
+    }
+    if (record >= JOURNAL_EVENT)
     {
         return false;
     }
 
-    // Try and load into a temporary game structure in case of errors.
-    struct game temp;
-    if (fread(&temp, sizeof temp, 1, fp) != 1)
+    // Make the move on a copy of the board, score and random number
+    // generator, so nothing changes unless it matches the record.
+    struct game next = *g;
+    enum direction dir = record & MOVE_DIR_MASK;
+    if (!try_move(g, dir, &next.board, &next.score))
+    {
+        return false;
+    }
+    int location = new_tile(&next, *random_tiles);
+    if (location < 0)
+    {
+        return false;
+    }
+    int four = tile_exponent(next.board, location / DIM, location % DIM) - 1;
+    if (record != (dir | location << MOVE_LOCATION_SHIFT |
+                   four << MOVE_FOUR_SHIFT))
     {
-        fclose(fp);
         return false;
     }
 
-    // Success, copy the data read in to the global game structure.
-    memcpy(&g, &temp, sizeof g);
-    fclose(fp);
+    struct keyframe position = { g->board, g->score };
+    struct rng rng = g->rng;
+    g->board = next.board;
+    g->score = next.score;
+    g->rng = next.rng;
+    if (!push_undo(g, dir, location))
+    {
+        g->board = position.board;
+        g->score = position.score;
+        g->rng = rng;
+        return false;
+    }
     return true;
 }
 
+/*
+ * Resumes the game recorded in the file JOURNALFILE defined in logic.h, by
+ * loading its snapshot and replaying every record after it, and stores in
+ * *random_tiles whether new tiles were being placed randomly. Replaying stops
+ * at the first record which cannot be replayed, such as one damaged in a
+ * crash. Returns true iff the snapshot was loaded, otherwise leaves the game
+ * as it was.
+ */
+bool resume_journal(struct game *g, bool *random_tiles)
+{
+    long size;
+    uint8_t *data = read_file(JOURNALFILE, JOURNAL_HEADER_SIZE, &size);
+    if (!data)
+    {
+        return false;
+    }
+
+    // The snapshot is checked as a save of its own.
+    unsigned flags = get_le(data + 6, 2);
+    long snapshot = get_le(data + 8, 4);
+    bool ok = memcmp(data, JOURNAL_MAGIC, 4) == 0 &&
+              get_le(data + 4, 2) == SAVE_VERSION &&
+              !(flags & ~JOURNAL_RANDOM) &&
+              snapshot <= size - JOURNAL_HEADER_SIZE &&
+              check_save(data + JOURNAL_HEADER_SIZE, snapshot, SAVE_MAGIC) &&
+              decode_game(g, data + JOURNAL_HEADER_SIZE, snapshot);
+    if (ok)
+    {
+        *random_tiles = flags & JOURNAL_RANDOM;
+        for (long n = JOURNAL_HEADER_SIZE + snapshot; n < size; n++)
+        {
+            if (!replay_record(g, data[n], random_tiles))
+            {
+                break;
+            }
+        }
+    }
+    free(data);
+    return ok;
+}
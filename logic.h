@@ -0,0 +1,403 @@
+/**
+ * logic.h
+ *
+ * Header file for the game logic of nc_2048, built as the library libnc2048.
+ * Nothing here depends on ncurses so the library can be used to play games
+ * headlessly.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef LOGIC_H
+#define LOGIC_H
+
+// Dimension of board.
+#define DIM 4
+
+// The board is packed into a single 64-bit integer. Each tile takes up four
+// bits (a nibble) holding log_2 of the tile's value, or 0 for an empty tile.
+// Row i occupies bits 16*i to 16*i+15 and within a row, the tile in column j
+// occupies bits 4*j to 4*j+3. For example, the board
+//     2    4    0    0
+//     0    0    0    0
+//     0    0    0    0
+//     0    0    0 2048
+// is stored as 0xB000000000000021. As a nibble holds at most 15, the largest
+// representable tile is 32768 and two 32768 tiles will not merge.
+typedef uint64_t board_t;
+
+// Number of bits used to store a single tile and a mask for a single tile.
+#define TILE_BITS 4
+#define TILE_MASK 0xF
+
+// Number of bits used to store a row of tiles and a mask for a single row.
+#define ROW_BITS 16
+#define ROW_MASK 0xFFFF
+
+// Directions in which tiles can be pushed.
+enum direction { LEFT, RIGHT, UP, DOWN };
+
+// Games can be saved in any of SAVE_SLOTS numbered slots, slot n being saved to
+// the file named by SAVEFILE with n in place of %d. The index file INDEXFILE
+// records the name and details of the game in each slot, so they can all be
+// listed without opening every save.
+#define SAVE_SLOTS 9
+#define SAVEFILE "nc2048_save_%d.dat"
+#define INDEXFILE "nc2048_index.dat"
+
+// Longest name of a saved game, not counting the terminating null character.
+#define SLOT_NAME_LENGTH 24
+
+// The game in progress is saved continuously to the journal JOURNALFILE, which
+// holds a snapshot of the game followed by a byte for each move or other
+// change since, so a game can be resumed exactly after the program is killed.
+// Moves are passed to the operating system as they are made, but only flushed
+// to disk every JOURNAL_SYNC_INTERVAL moves and when the journal is closed.
+#define JOURNALFILE "nc2048_journal.dat"
+#define JOURNAL_SYNC_INTERVAL 32
+
+// To allow a user to undo any number of moves we keep the whole history of a
+// game. Rather than a snapshot of the board after each move, the history
+// stores a byte per move holding the direction moved and the new tile placed,
+// plus a keyframe of the board and score every KEYFRAME_INTERVAL moves. Any
+// earlier position is found by replaying the moves after the nearest
+// keyframe, so a 10000 move game takes around 12 KB.
+#define KEYFRAME_INTERVAL 64
+
+// The board and score at some point in a game.
+struct keyframe
+{
+    board_t board;
+    int score;
+};
+
+// The history of a game, for undoing and redoing moves.
+struct history
+{
+    // The position at the start of the game.
+    struct keyframe start;
+
+    // The moves made since the start, encoded as described in logic.c. The
+    // first length moves lead to the current position and those after, up to
+    // end, have been undone and can be redone. There is space for capacity
+    // moves.
+    uint8_t *moves;
+    size_t length;
+    size_t end;
+    size_t capacity;
+
+    // The position after every KEYFRAME_INTERVAL moves, keyframes[n] being
+    // the position after move (n + 1) * KEYFRAME_INTERVAL. There is space for
+    // capacity / KEYFRAME_INTERVAL keyframes.
+    struct keyframe *keyframes;
+};
+
+// State of a xoshiro256** random number generator. It is fast, passes
+// statistical tests well and, since its state is held here rather than
+// globally, each game or thread can have its own.
+struct rng
+{
+    uint64_t s[4];
+};
+
+// A wrapper to contain all data for a single game. Every function in logic.c
+// takes a pointer to the game it acts on, so any number of independent games
+// can be played at once.
+struct game
+{
+    // The board's current tiles, packed as described above.
+    board_t board;
+
+    // The current score.
+    int score;
+
+    // The history of moves, for undoing and redoing them.
+    struct history history;
+
+    // The random number generator used to place new tiles.
+    struct rng rng;
+};
+
+// Changes to a game besides moves which are recorded in the journal.
+enum journal_event
+{
+    JOURNAL_UNDO,
+    JOURNAL_REDO,
+    JOURNAL_RANDOM_TILES,
+    JOURNAL_DETERMINISTIC_TILES
+};
+
+// An open journal.
+struct journal
+{
+    // The journal's file, or NULL if it is not open.
+    FILE *fp;
+
+    // The number of records written since the file was last flushed to disk.
+    int unsynced;
+};
+
+// Details of the game in a save slot, as recorded in the index file.
+struct slot_info
+{
+    // Whether a game has been saved in the slot. If not, the other fields are
+    // zero.
+    bool used;
+
+    // The name given to the game.
+    char name[SLOT_NAME_LENGTH + 1];
+
+    // The score and the value of the largest tile.
+    int score;
+    int max_tile;
+
+    // When the game was saved.
+    time_t saved;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions dealing with the game's logic, defined in logic.c.
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the value of the tile in row i and column j of a packed board, or 0
+ * if there is no tile there.
+ */
+int tile_value(board_t board, int i, int j);
+
+/*
+ * Returns log_2 of the value of the tile in row i and column j of a packed
+ * board, or 0 if there is no tile there.
+ */
+int tile_exponent(board_t board, int i, int j);
+
+/*
+ * Returns log_2 of the value of the largest tile on a packed board, or 0 if
+ * the board is empty.
+ */
+int max_exponent(board_t board);
+
+/*
+ * Returns the transpose of a packed board, i.e. the tile in row i and column j
+ * is swapped with the tile in row j and column i.
+ */
+board_t transpose(board_t board);
+
+/*
+ * Generates the tables used to move tiles and place new tiles. Must be called
+ * once, before any games are started, by any program using the library.
+ */
+void init_tables(void);
+
+/*
+ * Seeds a random number generator. Generators given the same seed produce the
+ * same numbers.
+ */
+void rng_seed(struct rng *rng, uint64_t seed);
+
+/*
+ * Returns a random 64-bit integer, advancing the random number generator.
+ */
+uint64_t rng_next(struct rng *rng);
+
+/*
+ * Returns a random integer uniformly distributed over [0, bound), advancing
+ * the random number generator. bound must be positive.
+ */
+uint32_t rng_below(struct rng *rng, uint32_t bound);
+
+/*
+ * Prepares a game with an empty history, ready for reset_game(). Must be
+ * called before a game is first used, and free_game() once it is finished
+ * with.
+ */
+void init_game(struct game *g);
+
+/*
+ * Frees the memory used by the history of a game.
+ */
+void free_game(struct game *g);
+
+/*
+ * Resets the board, score and history of a game ready for a new game and
+ * places the first tile. The random number generator is left as it is.
+ */
+void reset_game(struct game *g, bool random_tiles);
+
+/*
+ * Returns the result of pushing the tiles of a packed board in the given
+ * direction, adding the value of any merged tiles to *score. The board is
+ * unchanged if no tiles can move in that direction.
+ */
+board_t move_board(board_t board, enum direction dir, int *score);
+
+/*
+ * Pushes the tiles of each packed board in a batch of count boards, boards[n]
+ * in direction dirs[n], adding the value of any merged tiles to scores[n].
+ * Gives the same results as move_board() on each board in turn, but moves
+ * several boards at once with vector instructions if the processor has them.
+ */
+void move_boards(board_t *boards, int *scores, const uint8_t *dirs,
+                 size_t count);
+
+/*
+ * Computes the board and score a game would have after pushing its tiles in
+ * the given direction, without changing the game. Returns true iff tiles
+ * would move, in which case the results are stored in *board and *score.
+ */
+bool try_move(const struct game *g, enum direction dir, board_t *board,
+              int *score);
+
+/*
+ * Pushes tiles together in the left direction. Returns true if tiles have
+ * moved and false if no tiles moved.
+ * When pushed, tiles pass through any empty spaces and two tiles of the same
+ * value will merge into one. For example,
+ * the following rows of tiles on g->board would be transformed as
+ * [0,2,0,2] ---> [4,0,0,0]
+ * [4,0,4,4] ---> [8,4,0,0]
+ * [2,2,2,2] ---> [4,4,0,0]
+ * [2,4,4,2] ---> [2,8,2,0]
+ * Note from the second row that of possible merges, the leftmost merges happen
+ * first. Also note from the third row the merged tiles do not merge a second
+ * time, so [2,2,2,2] becomes [4,4,0,0] not [8,0,0,0]. Only a second call to
+ * left() would produce [8,0,0,0] on that row.
+ */
+bool left(struct game *g);
+
+/*
+ * Pushes tiles together in the right direction. Returns true if tiles have
+ * moved and false if no tiles moved.
+ */
+bool right(struct game *g);
+
+/*
+ * Pushes tiles together in the up direction. Returns true if tiles have moved
+ * and false if no tiles moved.
+ */
+bool up(struct game *g);
+
+/*
+ * Pushes tiles together in the down direction. Returns true if tiles have
+ * moved and false if no tiles moved.
+ */
+bool down(struct game *g);
+
+/*
+ * Returns a mask of the empty tiles on a packed board, with bit k set if the
+ * tile in row k / DIM and column k % DIM is empty.
+ */
+uint16_t empty_mask(board_t board);
+
+/*
+ * Places a new tile on the board. If random_tiles is false, places a '2' tile
+ * at the first available location on the board. If random_tiles is true,
+ * randomly selects an available location on the board and places a '2' tile
+ * there with probability 90%, or a '4' tile there with probability 10%.
+ * Returns the location used, numbered as the bits of empty_mask(), or -1 if
+ * the board is full.
+ */
+int new_tile(struct game *g, bool random_tiles);
+
+/*
+ * Returns true if it is possible for the user to make a move, otherwise
+ * returns false indicating game over.
+ */
+bool move_available(const struct game *g);
+
+/*
+ * Returns a mask of the directions in which tiles can be pushed on a packed
+ * board, with bit dir set if pushing in direction dir would move tiles.
+ */
+unsigned legal_moves(board_t board);
+
+/*
+ * Adds a move to the history of a game, the move being in direction dir and
+ * followed by a new tile at the given location, and the game's board and
+ * score being those after the new tile. Any undone moves can no longer be
+ * redone. Returns true iff successful.
+ */
+bool push_undo(struct game *g, enum direction dir, int location);
+
+/*
+ * If no moves are left in the history, return false. Otherwise, undo the last
+ * move in the history, reverting the tiles and score to the values they had
+ * before it, and return true. The move is kept so it can be redone.
+ */
+bool pop_undo(struct game *g);
+
+/*
+ * If no moves have been undone since the last move was made, return false.
+ * Otherwise, make the last move undone again, including its new tile, and
+ * return true.
+ */
+bool redo(struct game *g);
+
+/*
+ * Saves the current state of the game, and its history if history is true, in
+ * the numbered slot, from 1 to SAVE_SLOTS, under the given name, and records
+ * it in the index of slots. If successful returns true, otherwise returns
+ * false. The save is replaced in a single step, so a crash leaves either the
+ * old or the new save, and the old save is kept as a backup.
+ */
+bool save_game(const struct game *g, int slot, const char *name,
+               bool history);
+
+/*
+ * Loads the game saved in the numbered slot, from 1 to SAVE_SLOTS, and if
+ * successful returns true, otherwise returns false, leaving the game as it
+ * was. Files which are corrupt or from a later version of the format are
+ * rejected, in which case the backup of the previous save is loaded instead
+ * if possible.
+ */
+bool load_game(struct game *g, int slot);
+
+/*
+ * Reads the index of save slots into slots, marking every slot unused if
+ * there is no index yet. If the index is corrupt, the backup of the previous
+ * index is read instead if possible. Returns true iff successful.
+ */
+bool read_slots(struct slot_info slots[SAVE_SLOTS]);
+
+/*
+ * Starts a new journal in the file JOURNALFILE defined in logic.h, replacing
+ * any previous one, with a snapshot of the game including its history and
+ * whether new tiles are placed randomly. The journal j must be zeroed before
+ * it is first started. Returns true iff successful.
+ */
+bool start_journal(struct journal *j, const struct game *g, bool random_tiles);
+
+/*
+ * Appends the last move in the history of a game to a journal. Returns true
+ * iff successful.
+ */
+bool journal_move(struct journal *j, const struct game *g);
+
+/*
+ * Appends an event other than a move to a journal. Returns true iff
+ * successful.
+ */
+bool journal_event(struct journal *j, enum journal_event event);
+
+/*
+ * Flushes a journal to disk and closes it, if it is open. Returns true iff
+ * successful.
+ */
+bool close_journal(struct journal *j);
+
+/*
+ * Resumes the game recorded in the file JOURNALFILE defined in logic.h, by
+ * loading its snapshot and replaying every record after it, and stores in
+ * *random_tiles whether new tiles were being placed randomly. Replaying stops
+ * at the first record which cannot be replayed, such as one damaged in a
+ * crash. Returns true iff the snapshot was loaded, otherwise leaves the game
+ * as it was.
+ */
+bool resume_journal(struct game *g, bool *random_tiles);
+
+#endif
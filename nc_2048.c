@@ -21,32 +21,79 @@
  * To play, use the arrow keys to move tiles. Two tiles with matching numbers
  * will merge when pushed together. Whenever tiles move a new tile is added.
  * Other keys: n - new game, h - display help, q - quit, d - deterministic mode,
- * r - random mode, u - undo (up to three moves), s - save game, l - load saved
- * game.
+ * r - random mode, u - undo (any number of moves), y - redo an undone move,
+ * s - save game, l - load saved game (each choosing one of several named save
+ * slots), a - ask the automated player for a hint. The game is also saved
+ * after every move and resumed when the program next starts.
+ *
+ * Options: --depth N - the number of moves the automated player looks ahead,
+ * --threads N - the number of threads the automated player uses,
+ * --playouts N - the number of random games played after each move by the
+ * montecarlo policy, --selfplay N - play N games headlessly and print
+ * statistics, --policy NAME - how moves are picked in those games,
+ * --posdb FILE - store every position reached in those games in a position
+ * database, --seed N - seed for placing new tiles (starting a new game
+ * rather than resuming the last one).
  */
 
 #define _XOPEN_SOURCE 500
 
 #include "nc_2048.h"
+#include "ai.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <ncurses.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 // Macro for processing control characters.
 #define CTRL(x) ((x) & ~0140)
 
 struct game g;
 
+// The journal to which every move is saved as it is made.
+static struct journal journal;
+
+// A pipe to which the signal handler writes a byte whenever the window size
+// changes, so the main loop wakes up and redraws. This keeps ncurses out of
+// the signal handler, where it is not safe to use.
+static int resize_pipe[2];
+
+// Whether the terminal has closed, after which no more keys will come.
+static bool terminal_closed = false;
+
+// Keys are read through a window which is never drawn on, since reading them
+// through stdscr would update the screen after every key.
+static WINDOW *input;
+
+// The save slots and prompt shown while choose_slot() waits for a key, or
+// NULL, so they are shown again when the window is redrawn after a resize.
+static const struct slot_info *shown_slots = NULL;
+static const char *shown_prompt;
+
+// Names of the directions for displaying hints.
+static const char *direction_names[] = { "left", "right", "up", "down" };
+
 /*
- * Resets all game data ready for a new game and redraws.
+ * Resets all game data ready for a new game, starts a new journal and
+ * redraws.
  */
 void new_game(bool random_tiles);
 
+/*
+ * Starts a new journal with a snapshot of the game, displaying a message if
+ * this fails.
+ */
+void restart_journal(bool random_tiles);
+
 /*
  * Starts up ncurses. Checks window size and initialises colours. Returns true
  * iff successful.
@@ -54,13 +101,147 @@ void new_game(bool random_tiles);
 bool startup(void);
 
 /*
- * Handle terminal window size changed signal, if received calls redraw_all.
+ * Handle terminal window size changed signal, if received wakes up the main
+ * loop to call redraw_all.
  */
 void handle_signal(int signum);
 
+/*
+ * Waits for a key to be pressed for up to timeout_ms milliseconds, or forever
+ * if timeout_ms is negative, redrawing the window, and the save slots if
+ * choose_slot() is showing them, once for however many times it is resized
+ * meanwhile. Returns the key or ERR if none was pressed or the
+ * terminal has closed.
+ */
+int wait_for_key(int timeout_ms);
+
+/*
+ * Asks the automated player for the best move and displays it as a hint.
+ */
+void show_hint(struct ai *ai);
+
+/*
+ * Lists the save slots and asks the user to pick one with the given prompt,
+ * then redraws the help text if help_toggle is true or the logo otherwise.
+ * Returns the slot picked, from 1 to SAVE_SLOTS, or 0 if the user pressed any
+ * other key. The slots' details are stored in slots.
+ */
+int choose_slot(const char *prompt, bool help_toggle,
+                struct slot_info slots[SAVE_SLOTS]);
+
+/*
+ * Prints how to use the program to stderr.
+ */
+void usage(const char *program);
+
 
 int main(int argc, char *argv[])
 {
+    // Parse command line options.
+    int depth = AI_DEFAULT_DEPTH;
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int playouts = AI_DEFAULT_PLAYOUTS;
+    int games = 0;
+    const char *policy = "expectimax";
+    const char *posdb_path = NULL;
+    uint64_t seed = (uint64_t) time(NULL);
+    bool seeded = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+        {
+            depth = atoi(argv[++i]);
+            if (depth < 1)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+            if (threads < 1 || threads > AI_MAX_THREADS)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--playouts") == 0 && i + 1 < argc)
+        {
+            playouts = atoi(argv[++i]);
+            if (playouts < 1)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--selfplay") == 0 && i + 1 < argc)
+        {
+            games = atoi(argv[++i]);
+            if (games < 1)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc)
+        {
+            policy = argv[++i];
+        }
+        else if (strcmp(argv[i], "--posdb") == 0 && i + 1 < argc)
+        {
+            posdb_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            char *end;
+            seed = strtoull(argv[++i], &end, 10);
+            if (*end != '\0')
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            seeded = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    else if (threads > AI_MAX_THREADS)
+    {
+        threads = AI_MAX_THREADS;
+    }
+
+    // Play games headlessly if asked to, without starting ncurses. Any other
+    // failure has already been reported, and is not a mistake in the options.
+    if (games)
+    {
+        if (!is_policy(policy))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return selfplay(games, policy, depth, threads, playouts, seed,
+                        posdb_path) ? 0 : 1;
+    }
+
+    // Prepare the automated player used for hints.
+    init_tables();
+    init_ai_tables();
+    struct ai ai;
+    if (!ai_init(&ai, depth, threads))
+    {
+        fprintf(stderr, "Error starting the automated player!\n");
+        return 1;
+    }
+
     // Start up ncurses.
     if (!startup())
     {
@@ -68,32 +249,81 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Register handler for SIGWINCH (SIGnal WINdow CHanged).
-    signal(SIGWINCH, (void (*)(int)) handle_signal);
+    // Register handler for SIGWINCH (SIGnal WINdow CHanged), which writes to
+    // a pipe. Neither end of the pipe ever blocks, since a full pipe already
+    // holds a resize to be handled.
+    struct sigaction action = { .sa_handler = handle_signal,
+                                .sa_flags = SA_RESTART };
+    sigemptyset(&action.sa_mask);
+    if (pipe(resize_pipe) != 0 ||
+        fcntl(resize_pipe[0], F_SETFL, O_NONBLOCK) != 0 ||
+        fcntl(resize_pipe[1], F_SETFL, O_NONBLOCK) != 0 ||
+        sigaction(SIGWINCH, &action, NULL) != 0)
+    {
+        endwin();
+        fprintf(stderr, "Error handling window size changes!\n");
+        return 1;
+    }
 
-    // Seed random number generator.
-    srand48((long int) time(NULL));
+    // Prepare the game and seed its random number generator.
+    init_game(&g);
+    rng_seed(&g.rng, seed);
 
     // Some toggles for use in the game loop.
     bool new_tile_needed = false;
+    enum direction dir = LEFT;
     bool help_toggle = false;
     bool game_over = false;
     bool random_tiles = true;
 
-    // Initialize the game.
-    new_game(random_tiles);
+    // Resume the game from the last time the program ran if possible,
+    // otherwise start a new game. A resumed game brings its own generator, so
+    // if a seed was given start a new game with it instead, replacing the
+    // journal.
+    if (!seeded && resume_journal(&g, &random_tiles))
+    {
+        redraw_all();
+        restart_journal(random_tiles);
+    }
+    else
+    {
+        new_game(random_tiles);
+    }
 
     // The user's input.
     int ch;
 
-    // Main game loop.
+    // The save slots, the name of a save and a message about them.
+    struct slot_info slots[SAVE_SLOTS];
+    int slot;
+    char name[SLOT_NAME_LENGTH + 1];
+    char message[MAX_WIDTH_LOGO_HELP + 1];
+
+    // Main game loop. Every key already typed is handled before the screen is
+    // updated, so a burst of keys leads to a single update, and the loop then
+    // sleeps until the next key, doing nothing while the game is idle.
     do
     {
-        // Refresh the screen.
-        refresh();
+        // Get user's input, if any is waiting.
+        ch = wait_for_key(0);
+        if (ch == ERR)
+        {
+            // Check moves are still available and update scoreboard, then
+            // refresh the screen.
+            game_over = !move_available(&g);
+            update_scoreboard(game_over);
+            refresh();
+
+            // Wait for the next key. If the terminal has closed there are
+            // none to come, so quit.
+            ch = wait_for_key(-1);
+            if (ch == ERR)
+            {
+                ch = 'Q';
+            }
+        }
 
-        // Get user's input and capitalize.
-        ch = getch();
+        // Capitalize the input.
         ch = toupper(ch);
 
         // Process user's input.
@@ -104,8 +334,11 @@ int main(int argc, char *argv[])
                 new_game(random_tiles);
                 break;
 
-            // Let user manually redraw screen with ctrl-L.
+            // Let user manually redraw screen with ctrl-L. Since the terminal
+            // may have been written over, clear it and send every character
+            // again.
             case CTRL('l'):
+                clearok(curscr, true);
                 redraw_all();
                 break;
 
@@ -113,11 +346,13 @@ int main(int argc, char *argv[])
             case 'D':
                 random_tiles = false;
                 display_message("New tiles spawn deterministically.");
+                journal_event(&journal, JOURNAL_DETERMINISTIC_TILES);
                 break;
 
             case 'R':
                 random_tiles = true;
                 display_message("New tiles spawn randomly.");
+                journal_event(&journal, JOURNAL_RANDOM_TILES);
                 break;
 
             // Toggle display of help.
@@ -133,12 +368,18 @@ int main(int argc, char *argv[])
                 }
                 break;
 
+            // Ask the automated player for a hint.
+            case 'A':
+                show_hint(&ai);
+                break;
+
             // Undo a move.
             case 'U':
-                if (pop_undo())
+                if (pop_undo(&g))
                 {
                     draw_tiles();
                     game_over = false;
+                    journal_event(&journal, JOURNAL_UNDO);
                 }
                 else
                 {
@@ -146,62 +387,120 @@ int main(int argc, char *argv[])
                 }
                 break;
 
-            // Save the current game.
+            // Redo a move which was undone.
+            case 'Y':
+                if (redo(&g))
+                {
+                    draw_tiles();
+                    journal_event(&journal, JOURNAL_REDO);
+                }
+                else
+                {
+                    display_message("No redos available.");
+                }
+                break;
+
+            // Save the current game in a slot, under a name typed by the
+            // user. Without a name the slot keeps its old name, if any.
             case 'S':
-                if (!save_game())
+                slot = choose_slot("Save in which slot? (1-9)", help_toggle,
+                                   slots);
+                if (!slot)
+                {
+                    display_message("");
+                    break;
+                }
+                prompt_string("Name: ", name, sizeof name);
+                if (name[0] == '\0')
+                {
+                    if (slots[slot - 1].used)
+                    {
+                        strcpy(name, slots[slot - 1].name);
+                    }
+                    else
+                    {
+                        snprintf(name, sizeof name, "Game %d", slot);
+                    }
+                }
+                if (!save_game(&g, slot, name, true))
                 {
                     display_message("Error saving game!");
                 }
                 else
                 {
-                    display_message("Game saved.");
+                    snprintf(message, sizeof message, "Game saved in slot %d.",
+                             slot);
+                    display_message(message);
                 }
                 break;
 
-            // Load a previously saved game.
+            // Load a previously saved game from a slot.
             case 'L':
-                if (!load_game())
+                slot = choose_slot("Load which slot? (1-9)", help_toggle,
+                                   slots);
+                if (!slot)
+                {
+                    display_message("");
+                }
+                else if (!load_game(&g, slot))
                 {
                     display_message("Error loading game!");
                 }
                 else
                 {
                     redraw_all();
-                    display_message("Game loaded.");
+                    if (help_toggle)
+                    {
+                        display_help();
+                    }
+                    snprintf(message, sizeof message,
+                             "Game loaded from slot %d.", slot);
+                    display_message(message);
+                    restart_journal(random_tiles);
                 }
                 break;
 
             // Move the tiles with keypad.
             case KEY_LEFT:
-                new_tile_needed = left();
+                dir = LEFT;
+                new_tile_needed = left(&g);
                 break;
 
             case KEY_RIGHT:
-                new_tile_needed = right();
+                dir = RIGHT;
+                new_tile_needed = right(&g);
                 break;
 
             case KEY_UP:
-                new_tile_needed = up();
+                dir = UP;
+                new_tile_needed = up(&g);
                 break;
 
             case KEY_DOWN:
-                new_tile_needed = down();
+                dir = DOWN;
+                new_tile_needed = down(&g);
                 break;
         }
 
-        // Add new tile if needed then add game state to undo stack.
+        // Add new tile if needed then add the move to the history.
         if (new_tile_needed)
         {
-            new_tile(random_tiles);
+            int location = new_tile(&g, random_tiles);
             draw_tiles();
             new_tile_needed = false;
-            push_undo();
-            display_message("");
+            if (!push_undo(&g, dir, location))
+            {
+                display_message("Error recording move for undo!");
+            }
+            else if (!journal_move(&journal, &g))
+            {
+                display_message("Error saving move to journal!");
+            }
+            else
+            {
+                display_message("");
+            }
         }
-
-        // Check moves are still available and update scoreboard.
-        game_over = !move_available();
-        update_scoreboard(game_over);
     }
     while (ch != 'Q');
 
@@ -210,21 +509,34 @@ int main(int argc, char *argv[])
     printf("\033[2J");
     printf("\033[%d;%dH", 0, 0);
 
+    close_journal(&journal);
+    ai_free(&ai);
+    free_game(&g);
+
     return 0;
 }
 
 /*
- * Resets all game data ready for a new game and redraws.
+ * Resets all game data ready for a new game, starts a new journal and
+ * redraws.
  */
 void new_game(bool random_tiles)
 {
-    memset(g.tiles, 0, sizeof g.tiles);
-    g.score = 0;
-    g.undo.top = 0;
-    g.undo.size = 0;
-    new_tile(random_tiles);
-    push_undo();
+    reset_game(&g, random_tiles);
     redraw_all();
+    restart_journal(random_tiles);
+}
+
+/*
+ * Starts a new journal with a snapshot of the game, displaying a message if
+ * this fails.
+ */
+void restart_journal(bool random_tiles)
+{
+    if (!start_journal(&journal, &g, random_tiles))
+    {
+        display_message("Error starting journal!");
+    }
 }
 
 /*
@@ -344,8 +656,17 @@ bool startup(void)
         return false;
     }
 
+    // Create the window keys are read through.
+    input = newwin(1, 1, 0, 0);
+    if (input == NULL)
+    {
+        endwin();
+        return false;
+    }
+    untouchwin(input);
+
     // Enable arrow keys.
-    if (keypad(stdscr, true) == ERR)
+    if (keypad(stdscr, true) == ERR || keypad(input, true) == ERR)
     {
         endwin();
         return false;
@@ -354,24 +675,171 @@ bool startup(void)
     // Hide the cursor if we can.
     curs_set(0);
 
-    // Wait 1000 ms at a time for input.
-    timeout(1000);
+    // Never wait for keys in wgetch(), as wait_for_key() waits instead.
+    nodelay(input, true);
 
     return true;
 }
 
 /*
- * Handle terminal window size changed signal, if received calls redraw_all.
+ * Handle terminal window size changed signal, if received wakes up the main
+ * loop to call redraw_all.
  */
 void handle_signal(int signum)
 {
-    // If the window size changes then redraw everything.
+    // Only async-signal-safe functions may be called here, so just write to
+    // the pipe, keeping errno as it was for the code interrupted.
+    int saved_errno = errno;
     if (signum == SIGWINCH)
     {
-        redraw_all();
+        ssize_t written = write(resize_pipe[1], "", 1);
+        (void) written;
+    }
+    errno = saved_errno;
+}
+
+/*
+ * Waits for a key to be pressed for up to timeout_ms milliseconds, or forever
+ * if timeout_ms is negative, redrawing the window, and the save slots if
+ * choose_slot() is showing them, once for however many times it is resized
+ * meanwhile. Returns the key or ERR if none was pressed or the
+ * terminal has closed.
+ */
+int wait_for_key(int timeout_ms)
+{
+    while (true)
+    {
+        // ncurses may already have read keys from the terminal, e.g. while
+        // reading an escape sequence, so check for those before waiting.
+        // Resizing the window queues KEY_RESIZE, which is skipped since the
+        // resize has already been handled.
+        int ch = wgetch(input);
+        if (ch == KEY_RESIZE)
+        {
+            continue;
+        }
+        if (ch != ERR || terminal_closed)
+        {
+            return ch;
+        }
+
+        struct pollfd fds[2] = { { .fd = STDIN_FILENO, .events = POLLIN },
+                                 { .fd = resize_pipe[0], .events = POLLIN } };
+        int ready = poll(fds, 2, timeout_ms);
+        if (ready == 0 || (ready < 0 && errno != EINTR))
+        {
+            return ERR;
+        }
+
+        // Once the terminal has closed, read any keys left then give up,
+        // since poll() would return at once from now on.
+        if (ready > 0 && (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)))
+        {
+            terminal_closed = true;
+        }
+
+        // Empty the pipe, so a burst of resizes leads to a single redraw.
+        if (fds[1].revents & POLLIN)
+        {
+            char buffer[64];
+            while (read(resize_pipe[0], buffer, sizeof buffer) > 0)
+            {
+            }
+            redraw_all();
+            if (shown_slots)
+            {
+                display_slots(shown_slots);
+                display_message(shown_prompt);
+                refresh();
+            }
+        }
     }
+}
 
-    // Re-register this function to handle future signals.
-    signal(signum, (void (*)(int)) handle_signal);
+
+/*
+ * Asks the automated player for the best move and displays it as a hint.
+ */
+void show_hint(struct ai *ai)
+{
+    int dir = ai_best_move(ai, g.board);
+    if (dir < 0)
+    {
+        display_message("No moves available.");
+        return;
+    }
+
+    // Include the speed of the search in the hint.
+    char message[MAX_WIDTH_LOGO_HELP + 1];
+    double rate = ai->seconds > 0 ? ai->nodes / ai->seconds : 0;
+    snprintf(message, sizeof message, "Hint: %s (%.0f nodes/s)",
+             direction_names[dir], rate);
+    display_message(message);
 }
 
+/*
+ * Lists the save slots and asks the user to pick one with the given prompt,
+ * then redraws the help text if help_toggle is true or the logo otherwise.
+ * Returns the slot picked, from 1 to SAVE_SLOTS, or 0 if the user pressed any
+ * other key. The slots' details are stored in slots.
+ */
+int choose_slot(const char *prompt, bool help_toggle,
+                struct slot_info slots[SAVE_SLOTS])
+{
+    // An unreadable index only loses the details of the slots, so the user
+    // can still pick one.
+    if (!read_slots(slots))
+    {
+        prompt = "Slot list unreadable, pick 1-9:";
+    }
+    display_slots(slots);
+    display_message(prompt);
+    refresh();
+
+    // Wait for a key, keeping the slots shown if the window is resized.
+    shown_slots = slots;
+    shown_prompt = prompt;
+    int ch = wait_for_key(-1);
+    shown_slots = NULL;
+
+    if (help_toggle)
+    {
+        display_help();
+    }
+    else
+    {
+        draw_logo();
+    }
+
+    if (ch >= '1' && ch < '1' + SAVE_SLOTS)
+    {
+        return ch - '0';
+    }
+    return 0;
+}
+
+/*
+ * Prints how to use the program to stderr.
+ */
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--depth N] [--threads N] [--playouts N]"
+                    " [--seed N] [--selfplay N [--policy NAME]"
+                    " [--posdb FILE]]\n", program);
+    fprintf(stderr, "  --depth N       moves the automated player looks ahead"
+                    " (default %i)\n", AI_DEFAULT_DEPTH);
+    fprintf(stderr, "  --threads N     threads the automated player uses"
+                    " (default one per processor)\n");
+    fprintf(stderr, "  --playouts N    random games played after each move by"
+                    " montecarlo (default %i)\n", AI_DEFAULT_PLAYOUTS);
+    fprintf(stderr, "  --seed N        seed for placing new tiles"
+                    " (default the current time)\n");
+    fprintf(stderr, "  --selfplay N    play N games without the display and"
+                    " print statistics\n");
+    fprintf(stderr, "  --policy NAME   how to pick moves in those games"
+                    " (default expectimax), one of\n                  ");
+    list_policies(stderr);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --posdb FILE    store every position reached in those"
+                    " games in a database\n");
+}
@@ -4,7 +4,11 @@
  * Header file for nc_2048.
  */
 
+#include "logic.h"
+
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #ifndef NC2048_H
 #define NC2048_H
@@ -15,7 +19,7 @@
 
 // Maximum height and width for the display of help and the logo.
 #define MAX_WIDTH_LOGO_HELP 35
-#define MAX_HEIGHT_LOGO_HELP 15
+#define MAX_HEIGHT_LOGO_HELP 16
 
 // If we cannot change colours then use six default colours for tiles.
 #define TILE_A  COLOR_BLUE
@@ -76,51 +80,6 @@ enum { START = 0,
        PAIR_17,
        PAIR_INFO, PAIR_BORDER };
 
-// Dimension of board.
-#define DIM 4
-
-#define SAVEFILE "nc2048_save.dat"
-
-// To allow a user to undo moves we use a circular stack in which we store the
-// tiles and scores for the most recent non-trivial (i.e. a tile actually
-// moved) moves. UNDO_CAPACITY is the maximum number of moves that the user can
-// undo plus one.
-#define UNDO_CAPACITY 4
-
-// A stack structure to allow undoing moves.
-struct stack
-{
-    // An array of two-dimensional arrays for the board's tile numbers.
-    int tiles[UNDO_CAPACITY][DIM][DIM];
-
-    // An array for the scores.
-    int score[UNDO_CAPACITY];
-
-    // The top of the stack.
-    int top;
-
-    // The current size of the stack (at most equal to UNDO_CAPACITY).
-    int size;
-};
-
-// We use a single global variable g as a wrapper to contain all game data.
-struct game
-{
-    // Track the x,y co-ordinates for the top left of the board to aid
-    // functions that draw on the window.
-    int x, y;
-
-    // Use a two-dimensional array for the board's current tile numbers.
-    int tiles[DIM][DIM];
-
-    // The current score.
-    int score;
-
-    // A stack for undoing moves.
-    struct stack undo;
-};
-
-
 ////////////////////////////////////////////////////////////////////////////////
 // Functions used for drawing on the window, defined in display.c.
 ////////////////////////////////////////////////////////////////////////////////
@@ -138,8 +97,9 @@ void draw_borders(void);
 void draw_grid(void);
 
 /*
- * Draws the game's tiles. Only call after draw_grid has been called at least
- * once.
+ * Draws the game's tiles, skipping those unchanged since they were last drawn.
+ * The screen is updated by the next call to refresh() or doupdate(). Only call
+ * after draw_grid has been called at least once.
  */
 void draw_tiles(void);
 
@@ -159,97 +119,61 @@ void display_help(void);
  * Displays a message below and to the right of the game board. Only call after
  * draw_grid has been called at least once.
  */
-void display_message(char *s);
+void display_message(const char *s);
 
 /*
- * Update the scoreboard, called whenever score changes or game ends. Only call
- * after draw_grid has been called at least once.
- */
-void update_scoreboard(bool game_over);
-
-/*
- * (Re)draws everything to the window.
- */
-void redraw_all(void);
-
-
-////////////////////////////////////////////////////////////////////////////////
-// Functions dealing with the game's logic, defined in logic.c.
-////////////////////////////////////////////////////////////////////////////////
-
-/*
- * Pushes tiles together in the left direction. Returns true if tiles have
- * moved and false if no tiles moved.
- * When pushed, tiles pass through any empty spaces and two tiles of the same
- * value will merge into one. For example,
- * the following rows in our g.tiles array would be transformed as
- * [0,2,0,2] ---> [4,0,0,0]
- * [4,0,4,4] ---> [8,4,0,0]
- * [2,2,2,2] ---> [4,4,0,0]
- * [2,4,4,2] ---> [2,8,2,0]
- * Note from the second row that of possible merges, the leftmost merges happen
- * first. Also note from the third row the merged tiles do not merge a second
- * time, so [2,2,2,2] becomes [4,4,0,0] not [8,0,0,0]. Only a second call to
- * left() would produce [8,0,0,0] on that row.
- */
-bool left(void);
-
-/*
- * Pushes tiles together in the right direction. Returns true if tiles have
- * moved and false if no tiles moved.
- */
-bool right(void);
-
-/*
- * Pushes tiles together in the up direction. Returns true if tiles have moved
- * and false if no tiles moved.
+ * Lists the save slots in place of the logo or help text, with the name,
+ * score, largest tile and date of the game saved in each. Only call after
+ * draw_grid has been called at least once.
  */
-bool up(void);
+void display_slots(const struct slot_info slots[SAVE_SLOTS]);
 
 /*
- * Pushes tiles together in the down direction. Returns true if tiles have
- * moved and false if no tiles moved.
+ * Displays a prompt in place of a message and lets the user type a line of up
+ * to size - 1 characters after it, which is stored in s. Only call after
+ * draw_grid has been called at least once.
  */
-bool down(void);
+void prompt_string(const char *prompt, char *s, int size);
 
 /*
- * Places a new tile on the board. If random_tiles is false, places a '2' tile
- * at the first available location on the board. If random_tiles is true,
- * randomly selects an available location on the board and places a '2' tile
- * there with probability 90%, or a '4' tile there with probability 10%.
+ * Update the scoreboard, called whenever score changes or game ends. Only call
+ * after draw_grid has been called at least once.
  */
-void new_tile(bool random_tiles);
+void update_scoreboard(bool game_over);
 
 /*
- * Returns true if it is possible for the user to make a move, otherwise
- * returns false indicating game over.
+ * (Re)draws everything to the window, first resizing it if the terminal has
+ * changed size. Only the characters which differ from those on the terminal
+ * are sent to it.
  */
-bool move_available(void);
+void redraw_all(void);
 
-/*
- * Push the current tiles and score to the undo stack, cyclically overwriting
- * the oldest values if the stack capacity has been reached.
- */
-void push_undo(void);
+////////////////////////////////////////////////////////////////////////////////
+// Functions for playing games headlessly, defined in selfplay.c.
+////////////////////////////////////////////////////////////////////////////////
 
 /*
- * If no undos are available, return false. Otherwise, pop from the undo stack
- * reverting the tiles and score to the values they had prior to the last
- * (non-trivial) move and return true.
+ * Returns true iff name is the name of a policy available for self-play.
  */
-bool pop_undo(void);
+bool is_policy(const char *name);
 
 /*
- * Saves the current state of the game to the filename SAVEFILE defined in
- * nc_2048.h and if successful returns true, otherwise returns false.
+ * Prints the names of the policies available for self-play to stream.
  */
-bool save_game(void);
+void list_policies(FILE *stream);
 
 /*
- * Loads a previously saved game from the filename SAVEFILE defined in
- * nc_2048.h and if successful returns true, otherwise returns false.
+ * Plays the given number of games headlessly, picking moves with the named
+ * policy and placing new tiles randomly, then prints the throughput and the
+ * distributions of scores and largest tiles. The automated player, if used,
+ * searches to depth or plays the given number of random games after each
+ * move, with the given number of threads. The same seed gives the same games,
+ * as long as expectimax searches use a single thread. If posdb_path is not
+ * NULL, every position reached is added to the position database there.
+ * Returns false if the policy is unknown or cannot be prepared, or the
+ * positions cannot be stored, having printed an error for the last two.
  */
-bool load_game(void);
+bool selfplay(int games, const char *policy_name, int depth, int threads,
+              int playouts, uint64_t seed, const char *posdb_path);
 
 #endif
-
@@ -0,0 +1,444 @@
+/**
+ * posdb.c
+ *
+ * Defines functions for a database of positions held in memory-mapped files,
+ * for storing and querying millions of positions offline.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include "posdb.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Both files start with a magic number, the version of the format and a mark
+// whose bytes show the byte order the file was written in.
+#define POSDB_MAGIC "NC2P"
+#define INDEX_MAGIC "NC2X"
+#define POSDB_VERSION 1
+#define BYTE_ORDER_MARK 0x01020304
+
+// The number of records space is first made for, doubled whenever it runs
+// out, and log_2 of the number of slots the index starts with, doubled
+// whenever it is half full.
+#define INITIAL_CAPACITY 4096
+#define INITIAL_INDEX_BITS 13
+
+// The header of the file of records, followed by space for capacity records,
+// of which the first count are in use.
+struct posdb_header
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t byte_order;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+// A slot in the index, holding a board and one more than the number of its
+// record, or zero if the slot is empty.
+struct posdb_slot
+{
+    board_t board;
+    uint64_t record;
+};
+
+// The header of the index, followed by 2^bits slots. The index covers the
+// first count records, and is rebuilt when opened if that is not all of
+// them.
+struct posdb_index
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t slot_size;
+    uint32_t byte_order;
+    uint32_t bits;
+    uint64_t count;
+    uint64_t reserved;
+};
+
+_Static_assert(sizeof(struct position) == 16, "records must take 16 bytes");
+_Static_assert(sizeof(struct posdb_header) == 32, "header must be packed");
+_Static_assert(sizeof(struct posdb_index) == 32, "header must be packed");
+
+/*
+ * Resizes the file fd to size bytes and maps it into memory, first unmapping
+ * the old mapping of old_size bytes at old if it is not NULL. Returns the new
+ * mapping or NULL if unsuccessful.
+ */
+static void *remap_file(int fd, void *old, size_t old_size, size_t size)
+{
+    if (old)
+    {
+        munmap(old, old_size);
+    }
+    if (ftruncate(fd, size) != 0)
+    {
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/*
+ * Returns the size in bytes of the file of records with space for capacity
+ * records.
+ */
+static size_t records_size(uint64_t capacity)
+{
+    return sizeof(struct posdb_header) + capacity * sizeof(struct position);
+}
+
+/*
+ * Returns the size in bytes of the index with 2^bits slots.
+ */
+static size_t index_size(uint32_t bits)
+{
+    return sizeof(struct posdb_index) +
+           ((size_t) 1 << bits) * sizeof(struct posdb_slot);
+}
+
+/*
+ * Returns the slot in the index holding a packed board, or the empty slot
+ * where it would be added if it is not there.
+ */
+static struct posdb_slot *find_slot(const struct posdb *db, board_t board)
+{
+    struct posdb_slot *slots = (struct posdb_slot *) (db->index + 1);
+    uint32_t bits = db->index->bits;
+    size_t mask = ((size_t) 1 << bits) - 1;
+
+    // Fibonacci hashing as in the transposition table, then linear probing.
+    size_t n = (board * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+    while (slots[n].record && slots[n].board != board)
+    {
+        n = (n + 1) & mask;
+    }
+    return &slots[n];
+}
+
+/*
+ * Replaces the index with an empty one of 2^bits slots, then adds the first
+ * count records to it. Returns true iff successful.
+ */
+static bool rebuild_index(struct posdb *db, uint32_t bits, uint64_t count)
+{
+    // Shrinking the file to nothing first clears every slot.
+    size_t old_size = db->index ? index_size(db->index->bits) : 0;
+    if (db->index)
+    {
+        munmap(db->index, old_size);
+        db->index = NULL;
+    }
+    if (ftruncate(db->index_fd, 0) != 0)
+    {
+        return false;
+    }
+    db->index = remap_file(db->index_fd, NULL, 0, index_size(bits));
+    if (!db->index)
+    {
+        return false;
+    }
+
+    memcpy(db->index->magic, INDEX_MAGIC, 4);
+    db->index->version = POSDB_VERSION;
+    db->index->slot_size = sizeof(struct posdb_slot);
+    db->index->byte_order = BYTE_ORDER_MARK;
+    db->index->bits = bits;
+
+    // Records only hold boards not already stored, so each gets a new slot.
+    for (uint64_t n = 0; n < count; n++)
+    {
+        struct posdb_slot *slot = find_slot(db, db->positions[n].board);
+        slot->board = db->positions[n].board;
+        slot->record = n + 1;
+    }
+    db->index->count = count;
+    return true;
+}
+
+/*
+ * Returns log_2 of the number of slots the index needs for count records,
+ * keeping it at most half full.
+ */
+static uint32_t index_bits(uint64_t count)
+{
+    uint32_t bits = INITIAL_INDEX_BITS;
+    while (((uint64_t) 1 << bits) < 2 * count)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/*
+ * Opens the index of a database whose records are open, rebuilding it if it
+ * is new, damaged or does not cover every record. Returns true iff
+ * successful.
+ */
+static bool open_index(struct posdb *db, const char *path)
+{
+    char index_path[FILENAME_MAX];
+    if (snprintf(index_path, sizeof index_path, "%s%s", path,
+                 POSDB_INDEX_SUFFIX) >= (int) sizeof index_path)
+    {
+        return false;
+    }
+    db->index_fd = open(index_path, O_RDWR | O_CREAT, 0644);
+    if (db->index_fd < 0)
+    {
+        return false;
+    }
+
+    // Map the index as it is if it looks valid.
+    struct posdb_index header;
+    struct stat st;
+    if (fstat(db->index_fd, &st) == 0 &&
+        pread(db->index_fd, &header, sizeof header, 0) == sizeof header &&
+        memcmp(header.magic, INDEX_MAGIC, 4) == 0 &&
+        header.version == POSDB_VERSION &&
+        header.slot_size == sizeof(struct posdb_slot) &&
+        header.byte_order == BYTE_ORDER_MARK &&
+        header.bits >= INITIAL_INDEX_BITS && header.bits < 48 &&
+        (uint64_t) st.st_size == index_size(header.bits) &&
+        header.count == db->header->count &&
+        ((uint64_t) 1 << header.bits) >= 2 * header.count)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, db->index_fd, 0);
+        if (map != MAP_FAILED)
+        {
+            db->index = map;
+            return true;
+        }
+    }
+
+    return rebuild_index(db, index_bits(db->header->count),
+                         db->header->count);
+}
+
+/*
+ * Opens the position database at path, creating it if it does not exist.
+ * Returns true iff successful.
+ */
+bool posdb_open(struct posdb *db, const char *path)
+{
+    db->header = NULL;
+    db->positions = NULL;
+    db->index = NULL;
+    db->index_fd = -1;
+    db->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (db->fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(db->fd, &st) != 0)
+    {
+        posdb_close(db);
+        return false;
+    }
+
+    if (st.st_size == 0)
+    {
+        // Start a new database.
+        db->header = remap_file(db->fd, NULL, 0,
+                                records_size(INITIAL_CAPACITY));
+        if (!db->header)
+        {
+            posdb_close(db);
+            return false;
+        }
+        memcpy(db->header->magic, POSDB_MAGIC, 4);
+        db->header->version = POSDB_VERSION;
+        db->header->record_size = sizeof(struct position);
+        db->header->byte_order = BYTE_ORDER_MARK;
+        db->header->capacity = INITIAL_CAPACITY;
+    }
+    else
+    {
+        // Map the existing file, however large, without reading it. The file
+        // is grown before its capacity is updated, so if the program stopped
+        // in between it is larger than its capacity needs, and is trimmed.
+        struct posdb_header header;
+        if (pread(db->fd, &header, sizeof header, 0) != sizeof header ||
+            memcmp(header.magic, POSDB_MAGIC, 4) != 0 ||
+            header.version != POSDB_VERSION ||
+            header.record_size != sizeof(struct position) ||
+            header.byte_order != BYTE_ORDER_MARK ||
+            header.count > header.capacity || header.capacity < 1 ||
+            header.capacity > SIZE_MAX / sizeof(struct position) / 2 ||
+            (uint64_t) st.st_size < records_size(header.capacity) ||
+            ((uint64_t) st.st_size > records_size(header.capacity) &&
+             ftruncate(db->fd, records_size(header.capacity)) != 0))
+        {
+            posdb_close(db);
+            return false;
+        }
+        void *map = mmap(NULL, records_size(header.capacity),
+                         PROT_READ | PROT_WRITE, MAP_SHARED, db->fd, 0);
+        if (map == MAP_FAILED)
+        {
+            posdb_close(db);
+            return false;
+        }
+        db->header = map;
+    }
+    db->positions = (struct position *) (db->header + 1);
+
+    if (!open_index(db, path))
+    {
+        posdb_close(db);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Flushes a position database to disk and closes it.
+ */
+void posdb_close(struct posdb *db)
+{
+    posdb_sync(db);
+    if (db->index)
+    {
+        munmap(db->index, index_size(db->index->bits));
+        db->index = NULL;
+    }
+    if (db->header)
+    {
+        munmap(db->header, records_size(db->header->capacity));
+        db->header = NULL;
+        db->positions = NULL;
+    }
+    if (db->index_fd >= 0)
+    {
+        close(db->index_fd);
+        db->index_fd = -1;
+    }
+    if (db->fd >= 0)
+    {
+        close(db->fd);
+        db->fd = -1;
+    }
+}
+
+/*
+ * Flushes any changes to a position database to disk. Returns true iff
+ * successful.
+ */
+bool posdb_sync(struct posdb *db)
+{
+    bool ok = true;
+    if (db->header)
+    {
+        ok = msync(db->header, records_size(db->header->capacity),
+                   MS_SYNC) == 0;
+    }
+    if (db->index)
+    {
+        ok = msync(db->index, index_size(db->index->bits), MS_SYNC) == 0 &&
+             ok;
+    }
+    return ok;
+}
+
+/*
+ * Returns the number of positions in a database.
+ */
+size_t posdb_count(const struct posdb *db)
+{
+    return db->header->count;
+}
+
+/*
+ * Returns the position numbered n, counting from 0 in the order they were
+ * added, or NULL if there are not that many positions. The position is only
+ * valid until the next call to posdb_append() or posdb_close().
+ */
+const struct position *posdb_get(const struct posdb *db, size_t n)
+{
+    return n < db->header->count ? &db->positions[n] : NULL;
+}
+
+/*
+ * Returns the number of the position with the given packed board, or -1 if
+ * the board is not in the database.
+ */
+long long posdb_find(const struct posdb *db, board_t board)
+{
+    return (long long) find_slot(db, board)->record - 1;
+}
+
+/*
+ * Appends a batch of count positions to a database, skipping any whose board
+ * is already in the database or earlier in the batch, and stores the number
+ * added in *added. Returns true iff successful, otherwise the database must be
+ * closed.
+ */
+bool posdb_append(struct posdb *db, const struct position *positions,
+                  size_t count, size_t *added)
+{
+    *added = 0;
+    uint64_t n = db->header->count;
+
+    // Make space for the whole batch at once, in case none are stored yet.
+    uint64_t capacity = db->header->capacity;
+    while (capacity < n + count)
+    {
+        capacity *= 2;
+    }
+    if (capacity != db->header->capacity)
+    {
+        // The file is grown before its new capacity is written, so it is
+        // never too small for the capacity it records.
+        struct posdb_header *header = remap_file(
+            db->fd, db->header, records_size(db->header->capacity),
+            records_size(capacity));
+        db->header = header;
+        if (!header)
+        {
+            return false;
+        }
+        header->capacity = capacity;
+        db->positions = (struct position *) (header + 1);
+    }
+
+    for (size_t k = 0; k < count; k++)
+    {
+        struct posdb_slot *slot = find_slot(db, positions[k].board);
+        if (slot->record)
+        {
+            continue;
+        }
+
+        // The record is written before it is counted, so the file is always
+        // consistent.
+        db->positions[n] = positions[k];
+        db->header->count = ++n;
+        slot->board = positions[k].board;
+        slot->record = n;
+        db->index->count = n;
+        ++*added;
+
+        // Keep the index at most half full.
+        if (((uint64_t) 1 << db->index->bits) < 2 * (n + 1) &&
+            !rebuild_index(db, db->index->bits + 1, n))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,101 @@
+/**
+ * posdb.h
+ *
+ * Header file for the position database of nc_2048, part of libnc2048. It
+ * stores millions of positions for offline analysis, with each board stored
+ * once.
+ */
+
+#include "logic.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef POSDB_H
+#define POSDB_H
+
+// The database is a file of fixed-size records, which is memory-mapped so
+// opening it takes the same time however many positions it holds, and any
+// record can be read without reading those before it. A hash table keyed on
+// the packed board is kept in a second file, named by appending
+// POSDB_INDEX_SUFFIX, so positions already stored are skipped. The index is
+// rebuilt from the records if it is missing or out of date. Both files are in
+// the byte order of the machine which created them and are rejected by
+// machines with another.
+#define POSDB_INDEX_SUFFIX ".idx"
+
+// The headers of the two files, defined in posdb.c.
+struct posdb_header;
+struct posdb_index;
+
+// A position stored in the database, taking 16 bytes.
+struct position
+{
+    // The board's tiles, packed as described in logic.h.
+    board_t board;
+
+    // The score and the number of moves made when the position was reached.
+    uint32_t score;
+    uint32_t moves;
+};
+
+// An open position database.
+struct posdb
+{
+    // The file of records and its mapping, starting with its header and
+    // followed by the records.
+    int fd;
+    struct posdb_header *header;
+    struct position *positions;
+
+    // The file holding the index and its mapping.
+    int index_fd;
+    struct posdb_index *index;
+};
+
+/*
+ * Opens the position database at path, creating it if it does not exist.
+ * Returns true iff successful.
+ */
+bool posdb_open(struct posdb *db, const char *path);
+
+/*
+ * Flushes a position database to disk and closes it.
+ */
+void posdb_close(struct posdb *db);
+
+/*
+ * Flushes any changes to a position database to disk. Returns true iff
+ * successful.
+ */
+bool posdb_sync(struct posdb *db);
+
+/*
+ * Returns the number of positions in a database.
+ */
+size_t posdb_count(const struct posdb *db);
+
+/*
+ * Returns the position numbered n, counting from 0 in the order they were
+ * added, or NULL if there are not that many positions. The position is only
+ * valid until the next call to posdb_append() or posdb_close().
+ */
+const struct position *posdb_get(const struct posdb *db, size_t n);
+
+/*
+ * Returns the number of the position with the given packed board, or -1 if
+ * the board is not in the database.
+ */
+long long posdb_find(const struct posdb *db, board_t board);
+
+/*
+ * Appends a batch of count positions to a database, skipping any whose board
+ * is already in the database or earlier in the batch, and stores the number
+ * added in *added. Returns true iff successful, otherwise the database must be
+ * closed.
+ */
+bool posdb_append(struct posdb *db, const struct position *positions,
+                  size_t count, size_t *added);
+
+#endif
@@ -0,0 +1,361 @@
+/**
+ * selfplay.c
+ *
+ * Defines functions for playing many games headlessly, without ncurses, using
+ * a choice of policies to pick moves, and printing statistics about them.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include "nc_2048.h"
+#include "ai.h"
+#include "posdb.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Everything a policy may need to pick a move.
+struct selfplay
+{
+    // The automated player, only prepared for policies which use it, and the
+    // number of random games it plays after each move for rollouts.
+    struct ai ai;
+    int playouts;
+
+    // The random number generator for policies which pick moves randomly,
+    // separate from the one placing new tiles.
+    struct rng rng;
+};
+
+// A policy picks a direction to move in on a packed board with at least one
+// move available.
+struct policy
+{
+    const char *name;
+    int (*choose)(struct selfplay *sp, board_t board);
+    bool uses_ai;
+};
+
+/*
+ * Picks a move uniformly at random from the moves available.
+ */
+static int choose_random(struct selfplay *sp, board_t board)
+{
+    // Skip past a random number of the legal moves, lowest direction first.
+    unsigned legal = legal_moves(board);
+    for (uint32_t n = rng_below(&sp->rng, __builtin_popcount(legal)); n; n--)
+    {
+        legal &= legal - 1;
+    }
+    return __builtin_ctz(legal);
+}
+
+/*
+ * Picks the move which gains the most score, preferring left, right, up then
+ * down when there is a tie.
+ */
+static int choose_greedy(struct selfplay *sp, board_t board)
+{
+    int best_dir = -1;
+    int best = -1;
+    for (unsigned legal = legal_moves(board); legal; legal &= legal - 1)
+    {
+        int dir = __builtin_ctz(legal);
+        int score = 0;
+        move_board(board, dir, &score);
+        if (score > best)
+        {
+            best = score;
+            best_dir = dir;
+        }
+    }
+    return best_dir;
+}
+
+/*
+ * Picks the move found by the automated player's expectimax search.
+ */
+static int choose_expectimax(struct selfplay *sp, board_t board)
+{
+    return ai_best_move(&sp->ai, board);
+}
+
+/*
+ * Picks the move with the best mean score over random games played to the
+ * end by the automated player.
+ */
+static int choose_montecarlo(struct selfplay *sp, board_t board)
+{
+    return ai_rollout_move(&sp->ai, board, sp->playouts, &sp->rng);
+}
+
+// The policies available, looked up by name.
+static const struct policy policies[] = {
+    { "random", choose_random, false },
+    { "greedy", choose_greedy, false },
+    { "expectimax", choose_expectimax, true },
+    { "montecarlo", choose_montecarlo, true },
+};
+
+#define POLICY_COUNT (sizeof policies / sizeof policies[0])
+
+/*
+ * Compares two ints for qsort.
+ */
+static int compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns the policy with the given name, or NULL if there is none.
+ */
+static const struct policy *find_policy(const char *name)
+{
+    for (size_t p = 0; p < POLICY_COUNT; p++)
+    {
+        if (strcmp(policies[p].name, name) == 0)
+        {
+            return &policies[p];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns true iff name is the name of a policy available for self-play.
+ */
+bool is_policy(const char *name)
+{
+    return find_policy(name) != NULL;
+}
+
+/*
+ * Prints the names of the policies available for self-play to stream.
+ */
+void list_policies(FILE *stream)
+{
+    for (size_t p = 0; p < POLICY_COUNT; p++)
+    {
+        fprintf(stream, "%s%s", p ? ", " : "", policies[p].name);
+    }
+}
+
+/*
+ * Adds a position to the end of a growing array of count positions with space
+ * for capacity, making more space as needed. Returns true iff successful.
+ */
+static bool add_position(struct position **positions, size_t *count,
+                         size_t *capacity, const struct game *g, int moves)
+{
+    if (*count == *capacity)
+    {
+        size_t new_capacity = *capacity ? 2 * *capacity : 1024;
+        struct position *p = realloc(*positions,
+                                     new_capacity * sizeof *p);
+        if (!p)
+        {
+            return false;
+        }
+        *positions = p;
+        *capacity = new_capacity;
+    }
+    (*positions)[(*count)++] = (struct position) { g->board, g->score, moves };
+    return true;
+}
+
+/*
+ * Plays the given number of games headlessly, picking moves with the named
+ * policy and placing new tiles randomly, then prints the throughput and the
+ * distributions of scores and largest tiles. The automated player, if used,
+ * searches to depth or plays the given number of random games after each
+ * move, with the given number of threads. The same seed gives the same games,
+ * as long as expectimax searches use a single thread. If posdb_path is not
+ * NULL, every position reached is added to the position database there.
+ * Returns false if the policy is unknown or cannot be prepared, or the
+ * positions cannot be stored, having printed an error for the last two.
+ */
+bool selfplay(int games, const char *policy_name, int depth, int threads,
+              int playouts, uint64_t seed, const char *posdb_path)
+{
+    const struct policy *policy = find_policy(policy_name);
+    if (!policy)
+    {
+        return false;
+    }
+
+    init_tables();
+
+    struct selfplay sp;
+    sp.playouts = playouts;
+    if (policy->uses_ai)
+    {
+        init_ai_tables();
+        if (!ai_init(&sp.ai, depth, threads))
+        {
+            fprintf(stderr, "Error starting the automated player!\n");
+            return false;
+        }
+    }
+
+    // Positions are stored a game at a time.
+    struct posdb db;
+    struct position *positions = NULL;
+    size_t position_count = 0;
+    size_t position_capacity = 0;
+    size_t positions_added = 0;
+    double posdb_seconds = 0;
+    if (posdb_path && !posdb_open(&db, posdb_path))
+    {
+        fprintf(stderr, "Error opening position database %s\n", posdb_path);
+        if (policy->uses_ai)
+        {
+            ai_free(&sp.ai);
+        }
+        return false;
+    }
+
+    int *scores = malloc(games * sizeof *scores);
+    if (!scores)
+    {
+        fprintf(stderr, "Error allocating memory for %i games!\n", games);
+        if (posdb_path)
+        {
+            posdb_close(&db);
+        }
+        if (policy->uses_ai)
+        {
+            ai_free(&sp.ai);
+        }
+        return false;
+    }
+
+    // Count the games reaching each largest tile, by its exponent.
+    long max_tiles[TILE_MASK + 1] = { 0 };
+    long moves = 0;
+
+    // Total the random games played by rollouts and the time spent on them.
+    unsigned long long rollouts = 0;
+    double rollout_seconds = 0;
+
+    struct game g;
+    init_game(&g);
+    rng_seed(&g.rng, seed);
+    rng_seed(&sp.rng, ~seed);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Storing positions stops the games early if it fails, so only the games
+    // played so far are counted.
+    bool ok = true;
+    int played = 0;
+    for (int n = 0; n < games && ok; n++, played++)
+    {
+        reset_game(&g, true);
+        int game_moves = 0;
+        position_count = 0;
+        while (move_available(&g))
+        {
+            if (posdb_path)
+            {
+                ok = ok && add_position(&positions, &position_count,
+                                        &position_capacity, &g, game_moves);
+            }
+            int dir = policy->choose(&sp, g.board);
+            if (policy->uses_ai && sp.ai.playouts)
+            {
+                rollouts += sp.ai.playouts;
+                rollout_seconds += sp.ai.seconds;
+            }
+            g.board = move_board(g.board, dir, &g.score);
+            new_tile(&g, true);
+            game_moves++;
+            moves++;
+        }
+        scores[n] = g.score;
+        max_tiles[max_exponent(g.board)]++;
+
+        // Store the game's positions, including the last, in one batch.
+        if (posdb_path && ok)
+        {
+            struct timespec posdb_start, posdb_end;
+            clock_gettime(CLOCK_MONOTONIC, &posdb_start);
+            size_t added = 0;
+            ok = add_position(&positions, &position_count, &position_capacity,
+                              &g, game_moves) &&
+                 posdb_append(&db, positions, position_count, &added);
+            positions_added += added;
+            clock_gettime(CLOCK_MONOTONIC, &posdb_end);
+            posdb_seconds += (posdb_end.tv_sec - posdb_start.tv_sec) +
+                             (posdb_end.tv_nsec - posdb_start.tv_nsec) / 1e9;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    // Print the throughput.
+    printf("Played %i games (%ld moves) with policy %s and seed %llu"
+           " in %.3f s\n", played, moves, policy->name,
+           (unsigned long long) seed, seconds);
+    printf("%.1f games/s, %.0f moves/s\n", played / seconds, moves / seconds);
+    if (rollouts)
+    {
+        printf("%llu playouts, %.0f playouts/s\n", rollouts,
+               rollouts / rollout_seconds);
+    }
+    // A failed append may leave the database unmapped, so it is only counted
+    // if every append succeeded.
+    if (posdb_path && ok)
+    {
+        printf("%zu new positions stored in %s, now holding %zu, in %.3f s\n",
+               positions_added, posdb_path, posdb_count(&db), posdb_seconds);
+    }
+
+    // Print the distribution of scores.
+    qsort(scores, played, sizeof *scores, compare_ints);
+    double total = 0;
+    for (int n = 0; n < played; n++)
+    {
+        total += scores[n];
+    }
+    printf("\nScore: min %i, 25%% %i, median %i, 75%% %i, max %i, mean %.1f\n",
+           scores[0], scores[played / 4], scores[played / 2],
+           scores[played * 3 / 4], scores[played - 1], total / played);
+
+    // Print the histogram of largest tiles.
+    printf("\nLargest tile:\n");
+    for (int e = 1; e <= TILE_MASK; e++)
+    {
+        if (max_tiles[e])
+        {
+            printf("%8i %8ld %6.1f%%\n", 1 << e, max_tiles[e],
+                   100.0 * max_tiles[e] / played);
+        }
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "Error storing positions in %s\n", posdb_path);
+    }
+
+    free(scores);
+    free(positions);
+    free_game(&g);
+    if (posdb_path)
+    {
+        posdb_close(&db);
+    }
+    if (policy->uses_ai)
+    {
+        ai_free(&sp.ai);
+    }
+    return ok;
+}